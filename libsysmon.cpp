@@ -0,0 +1,167 @@
+// libsysmon.cpp
+// The public Sampler API (sysmon.h) on top of the core collectors.
+
+#include "sysmon.h"
+#include "sysmon_core.h"
+
+namespace sysmon {
+
+// The uid cache and the memory total are shared by every Collector in the
+// process, so samplers take turns. Each sampler interns into its own string
+// pool: a pool's epoch advances with its collector's ticks, so a shared one
+// would let a fast sampler free the strings a slow one still holds.
+static mutex core_mu;
+
+// Hidden explicitly: a nested class takes the exported Sampler's visibility.
+struct __attribute__((visibility("hidden"))) Sampler::Impl {
+    chrono::milliseconds interval;
+    Scope scope;
+
+    mutex mu; // guards everything below
+    condition_variable wake;
+    thread worker;
+    bool stopping = false;
+    uint64_t seq = 0;
+    shared_ptr<const Snapshot> last;
+    vector<pair<int, Callback>> subscribers;
+    int next_id = 1;
+
+    StringPool pool;                 // the collector's strings
+    unique_ptr<Collector> collector; // used under core_mu only
+    TickArena arena;
+
+    Impl(chrono::milliseconds interval, Scope scope) : interval(interval), scope(scope) {}
+
+    shared_ptr<const Snapshot> sample() {
+        auto snap = make_shared<Snapshot>();
+        {
+            lock_guard<mutex> core(core_mu);
+            if (!total_mem_kb_cache) total_mem_kb_cache = read_total_memory_kb();
+            if (!collector) {
+                collector = make_unique<Collector>(pool);
+                if (scope == Scope::Self) collector->only_pid = getpid();
+            }
+            arena.reset();
+            Sample s(arena.resource());
+            collector->collect(s, arena.resource());
+            snap->ts_ms = unix_ms();
+            snap->cpu_usage = s.cpu_usage;
+            snap->mem_total_kb = s.mem_total;
+            snap->mem_used_kb = s.mem_used;
+            snap->processes.reserve(s.procs.size());
+            for (const ProcSnapshot &p : s.procs) {
+                if (!p.starttime) continue; // exited while being read
+                Process &q = snap->processes.emplace_back();
+                q.pid = p.pid;
+                q.starttime = p.starttime;
+                q.state = p.state;
+                q.user.assign(pool.str(p.user));
+                q.cmd.assign(pool.str(p.cmd));
+                q.unit.assign(pool.str(p.unit));
+                q.cpu_percent = p.cpu_percent;
+                q.mem_percent = p.mem_percent;
+                q.rss_kb = p.rss;
+                q.cpu_time_ticks = p.total_time();
+                q.io_read_bytes = p.io_read;
+                q.io_write_bytes = p.io_write;
+            }
+        }
+        sort(snap->processes.begin(), snap->processes.end(),
+             [](const Process &a, const Process &b) { return a.pid < b.pid; });
+
+        vector<Callback> targets;
+        {
+            lock_guard<mutex> lk(mu);
+            snap->seq = ++seq;
+            last = snap;
+            for (auto &s : subscribers) targets.push_back(s.second);
+        }
+        // outside the lock, so callbacks may call back into the sampler
+        for (auto &cb : targets) cb(*snap);
+        return snap;
+    }
+
+    void run() {
+        unique_lock<mutex> lk(mu);
+        while (!stopping) {
+            lk.unlock();
+            sample();
+            lk.lock();
+            wake.wait_for(lk, interval, [&] { return stopping; });
+        }
+    }
+};
+
+Sampler::Sampler(chrono::milliseconds interval, Scope scope) : impl(make_unique<Impl>(interval, scope)) {}
+
+Sampler::~Sampler() { stop(); }
+
+void Sampler::start() {
+    lock_guard<mutex> lk(impl->mu);
+    if (impl->worker.joinable()) return;
+    impl->stopping = false;
+    impl->worker = thread([this] { impl->run(); });
+}
+
+void Sampler::stop() {
+    thread t;
+    {
+        lock_guard<mutex> lk(impl->mu);
+        if (!impl->worker.joinable()) return;
+        impl->stopping = true;
+        t = move(impl->worker);
+    }
+    impl->wake.notify_all();
+    t.join();
+}
+
+bool Sampler::running() const {
+    lock_guard<mutex> lk(impl->mu);
+    return impl->worker.joinable();
+}
+
+shared_ptr<const Snapshot> Sampler::tick() { return impl->sample(); }
+
+shared_ptr<const Snapshot> Sampler::latest() const {
+    lock_guard<mutex> lk(impl->mu);
+    return impl->last;
+}
+
+vector<Process> Sampler::top(size_t k, SortKey key) const {
+    shared_ptr<const Snapshot> s = latest();
+    if (!s) return {};
+    vector<const Process *> order;
+    order.reserve(s->processes.size());
+    for (const Process &p : s->processes) order.push_back(&p);
+    k = min(k, order.size());
+    auto value = [key](const Process *p) { return key == SortKey::Cpu ? p->cpu_percent : p->mem_percent; };
+    partial_sort(order.begin(), order.begin() + k, order.end(), [&](const Process *a, const Process *b) {
+        if (value(a) != value(b)) return value(a) > value(b);
+        return a->pid < b->pid;
+    });
+    vector<Process> out;
+    out.reserve(k);
+    for (size_t i = 0; i < k; ++i) out.push_back(*order[i]);
+    return out;
+}
+
+int Sampler::subscribe(Callback cb) {
+    lock_guard<mutex> lk(impl->mu);
+    int id = impl->next_id++;
+    impl->subscribers.emplace_back(id, move(cb));
+    return id;
+}
+
+void Sampler::unsubscribe(int id) {
+    lock_guard<mutex> lk(impl->mu);
+    auto &subs = impl->subscribers;
+    subs.erase(remove_if(subs.begin(), subs.end(), [id](const auto &s) { return s.first == id; }), subs.end());
+}
+
+const Process *find_process(const Snapshot &s, int pid) {
+    auto it = lower_bound(s.processes.begin(), s.processes.end(), pid,
+                          [](const Process &p, int pid) { return p.pid < pid; });
+    return it != s.processes.end() && it->pid == pid ? &*it : nullptr;
+}
+
+} // namespace sysmon
@@ -0,0 +1,103 @@
+// sysmon.h
+// libsysmon: in-process host and self monitoring.
+// Link with -lsysmon -pthread (static libsysmon.a or shared libsysmon.so).
+//
+//   sysmon::Sampler sampler(std::chrono::milliseconds(1000));
+//   sampler.subscribe([](const sysmon::Snapshot &s) { ... });
+//   sampler.start();
+//   auto top = sampler.top(5, sysmon::SortKey::Cpu);
+//   sampler.stop();
+//
+// Only standard types cross this header, and Sampler keeps its state behind
+// a pointer, so the layout of the classes below is the whole ABI.
+
+#ifndef SYSMON_H
+#define SYSMON_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SYSMON_API_VERSION 1
+
+// The library is built with -fvisibility=hidden; only what is marked here is
+// exported from libsysmon.so.
+#define SYSMON_EXPORT __attribute__((visibility("default")))
+
+namespace sysmon {
+
+struct Process {
+    int pid = 0;
+    uint64_t starttime = 0; // clock ticks after boot; tells PID reuse apart
+    char state = '?';       // R, S, D, Z, ...
+    std::string user, cmd;
+    std::string unit;       // container ID or systemd unit, "-" if none
+    double cpu_percent = 0; // of all CPUs, over the last interval
+    double mem_percent = 0;
+    uint64_t rss_kb = 0;
+    uint64_t cpu_time_ticks = 0; // utime + stime
+    uint64_t io_read_bytes = 0, io_write_bytes = 0; // 0 if /proc/<pid>/io is not readable
+};
+
+struct Snapshot {
+    uint64_t seq = 0;   // 1 for the first sample
+    uint64_t ts_ms = 0; // Unix milliseconds
+    double cpu_usage = 0; // host CPU %, over the last interval
+    uint64_t mem_total_kb = 0, mem_used_kb = 0;
+    std::vector<Process> processes; // ascending pid
+};
+
+enum class SortKey { Cpu, Mem };
+
+enum class Scope {
+    AllProcesses, // every process of the host
+    Self          // only the calling process (host CPU and memory still filled in)
+};
+
+// Samples /proc every interval on a background thread. The first sample is
+// taken by start() (or tick()); %CPU values are relative to the previous one,
+// so they are 0 in the first snapshot.
+class SYSMON_EXPORT Sampler {
+public:
+    using Callback = std::function<void(const Snapshot &)>;
+
+    explicit Sampler(std::chrono::milliseconds interval = std::chrono::milliseconds(2000),
+                     Scope scope = Scope::AllProcesses);
+    ~Sampler(); // stops the thread
+    Sampler(const Sampler &) = delete;
+    Sampler &operator=(const Sampler &) = delete;
+
+    void start(); // no-op if already running
+    void stop();  // waits for a sample in progress; no-op if not running
+    bool running() const;
+
+    // Takes one sample on the calling thread, for callers that drive the
+    // timing themselves (without start()).
+    std::shared_ptr<const Snapshot> tick();
+
+    // Newest snapshot, or nullptr before the first sample. Snapshots are
+    // immutable and stay valid as long as the caller holds them.
+    std::shared_ptr<const Snapshot> latest() const;
+
+    // The k processes of the latest snapshot with the highest %CPU or %MEM.
+    std::vector<Process> top(size_t k, SortKey key = SortKey::Cpu) const;
+
+    // Calls cb after every sample, on the sampling thread; it should return
+    // quickly. Returns an id for unsubscribe().
+    int subscribe(Callback cb);
+    void unsubscribe(int id);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// The process with the given pid in s, or nullptr.
+SYSMON_EXPORT const Process *find_process(const Snapshot &s, int pid);
+
+} // namespace sysmon
+
+#endif // SYSMON_H
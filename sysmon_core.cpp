@@ -0,0 +1,678 @@
+// sysmon_core.cpp
+// Collectors, process table and delta coders (see sysmon_core.h).
+
+#include "sysmon_core.h"
+
+StringPool strings;
+long Hertz = sysconf(_SC_CLK_TCK);
+unsigned long long total_mem_kb_cache = 0;
+
+bool read_file(const char *path, pmr::string &out) {
+    out.clear();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    size_t len = 0;
+    while (true) {
+        if (out.size() < len + 4096) out.resize(len + 4096);
+        ssize_t n = read(fd, &out[len], out.size() - len);
+        if (n <= 0) break;
+        len += n;
+    }
+    close(fd);
+    out.resize(len);
+    return true;
+}
+
+unsigned long long meminfo_value(string_view text, string_view key) {
+    size_t at = 0;
+    while ((at = text.find(key, at)) != string_view::npos) {
+        if (at == 0 || text[at - 1] == '\n') {
+            string_view rest = text.substr(at + key.size());
+            return next_ull(rest);
+        }
+        at += key.size();
+    }
+    return 0;
+}
+
+CpuSnapshot read_cpu_line(pmr::memory_resource *mr) {
+    CpuSnapshot s{};
+    pmr::string buf(mr);
+    if (!read_file("/proc/stat", buf)) return s;
+    // Example: cpu  4705 150 1994 136239 234 0 45 0 0 0
+    string_view line(buf);
+    if (line.rfind("cpu ", 0) != 0) return s;
+    uint64_t v[10] = {};
+    scan_fields(line.substr(4), v, 10);
+    s.user = v[0]; s.nice = v[1]; s.system = v[2]; s.idle = v[3]; s.iowait = v[4];
+    s.irq = v[5]; s.softirq = v[6]; s.steal = v[7]; s.guest = v[8]; s.guest_nice = v[9];
+    return s;
+}
+
+unsigned long long read_total_memory_kb() {
+    ifstream f("/proc/meminfo");
+    string line;
+    unsigned long long memTotal = 0;
+    while (getline(f, line)) {
+        if (line.rfind("MemTotal:", 0) == 0) {
+            stringstream ss(line);
+            string label; unsigned long long val; string unit;
+            ss >> label >> val >> unit;
+            memTotal = val; // kB
+            break;
+        }
+    }
+    return memTotal;
+}
+
+// Value of a "Node 0 Key:   123 kB" line of a node's meminfo; key starts with a blank.
+static unsigned long long node_meminfo_value(string_view text, string_view key) {
+    size_t at = text.find(key);
+    if (at == string_view::npos) return 0;
+    string_view rest = text.substr(at + key.size());
+    return next_ull(rest);
+}
+
+vector<NumaNode> read_numa_nodes() {
+    vector<NumaNode> nodes;
+    DIR *d = opendir("/sys/devices/system/node");
+    if (!d) return nodes;
+    pmr::string buf;
+    char path[96];
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        const char *name = entry->d_name;
+        if (strncmp(name, "node", 4) != 0 || !isdigit((unsigned char)name[4])) continue;
+        NumaNode n;
+        n.id = atoi(name + 4);
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/meminfo", n.id);
+        if (read_file(path, buf)) {
+            n.mem_total = node_meminfo_value(buf, " MemTotal:");
+            n.mem_free = node_meminfo_value(buf, " MemFree:");
+            n.file_pages = node_meminfo_value(buf, " FilePages:");
+        }
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/numastat", n.id);
+        if (read_file(path, buf)) {
+            n.numa_hit = meminfo_value(buf, "numa_hit");
+            n.numa_miss = meminfo_value(buf, "numa_miss");
+            n.numa_foreign = meminfo_value(buf, "numa_foreign");
+        }
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", n.id);
+        if (read_file(path, buf)) n.cpus = parse_cpu_list(buf);
+        nodes.push_back(move(n));
+    }
+    closedir(d);
+    sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+}
+
+vector<int> parse_cpu_list(string_view s) {
+    vector<int> cpus;
+    size_t i = 0;
+    auto number = [&] {
+        int v = 0;
+        while (i < s.size() && isdigit((unsigned char)s[i])) v = v * 10 + (s[i++] - '0');
+        return v;
+    };
+    while (i < s.size() && isdigit((unsigned char)s[i])) {
+        int lo = number(), hi = lo;
+        if (i < s.size() && s[i] == '-') {
+            ++i;
+            hi = number();
+        }
+        for (int c = lo; c <= hi; ++c) cpus.push_back(c);
+        if (i < s.size() && s[i] == ',') ++i;
+    }
+    return cpus;
+}
+
+vector<int> cpu_nodes(const vector<NumaNode> &nodes) {
+    vector<int> node_of;
+    for (const NumaNode &n : nodes)
+        for (int c : n.cpus) {
+            if ((size_t)c >= node_of.size()) node_of.resize(c + 1, -1);
+            node_of[c] = n.id;
+        }
+    return node_of;
+}
+
+bool read_proc_numa(pid_t pid, const vector<int> &cpu_node, ProcNumaUsage &out) {
+    out.node_kb.clear();
+    out.node_threads.clear();
+    char path[64];
+    pmr::string buf;
+    snprintf(path, sizeof path, "/proc/%d/numa_maps", (int)pid);
+    if (!read_file(path, buf)) return false;
+
+    // one mapping per line: "<addr> <policy> ... N0=12 N1=3 kernelpagesize_kB=4"
+    string_view text(buf);
+    while (!text.empty()) {
+        size_t eol = min(text.find('\n'), text.size());
+        string_view line = text.substr(0, eol);
+        text.remove_prefix(min(eol + 1, text.size()));
+        unsigned long long page_kb = 4;
+        size_t at = line.find(" kernelpagesize_kB=");
+        if (at != string_view::npos) {
+            string_view rest = line.substr(at + 19);
+            page_kb = next_ull(rest);
+        }
+        for (at = line.find(" N"); at != string_view::npos; at = line.find(" N", at + 2)) {
+            size_t i = at + 2;
+            unsigned node = 0;
+            while (i < line.size() && isdigit((unsigned char)line[i])) node = node * 10 + (line[i++] - '0');
+            if (i == at + 2 || i >= line.size() || line[i] != '=') continue;
+            string_view rest = line.substr(i + 1);
+            if (node >= out.node_kb.size()) out.node_kb.resize(node + 1);
+            out.node_kb[node] += next_ull(rest) * page_kb;
+        }
+    }
+
+    // the CPU each thread last ran on is field 39 of its stat
+    snprintf(path, sizeof path, "/proc/%d/task", (int)pid);
+    DIR *d = opendir(path);
+    if (!d) return true;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        char stat_path[96];
+        int len = snprintf(stat_path, sizeof stat_path, "/proc/%d/task/%s/stat", (int)pid, entry->d_name);
+        if (len < 0 || (size_t)len >= sizeof stat_path || !read_file(stat_path, buf)) continue;
+        size_t close_paren = buf.rfind(')');
+        if (close_paren == pmr::string::npos || close_paren + 4 >= buf.size()) continue;
+        uint64_t v[36] = {}; // v[i] = field i + 4
+        if (scan_fields(string_view(buf).substr(close_paren + 4), v, 36) < 36) continue;
+        int node = v[35] < cpu_node.size() ? cpu_node[v[35]] : -1;
+        if (node < 0) continue;
+        if ((size_t)node >= out.node_threads.size()) out.node_threads.resize(node + 1);
+        ++out.node_threads[node];
+    }
+    closedir(d);
+    return true;
+}
+
+bool read_vmstat(VmStat &out, pmr::memory_resource *mr) {
+    // several names may add up into one counter (pgsteal_anon/_file split the
+    // same pages by type, so they are not added)
+    static const pair<string_view, unsigned long long VmStat::*> counters[] = {
+        {"thp_fault_alloc", &VmStat::thp_fault_alloc},
+        {"thp_fault_fallback", &VmStat::thp_fault_fallback},
+        {"thp_collapse_alloc", &VmStat::thp_collapse_alloc},
+        {"thp_split_page", &VmStat::thp_split_page},
+        {"compact_stall", &VmStat::compact_stall},
+        {"compact_fail", &VmStat::compact_fail},
+        {"compact_success", &VmStat::compact_success},
+        {"pgscan_kswapd", &VmStat::pgscan_kswapd},
+        {"pgscan_direct", &VmStat::pgscan_direct},
+        {"pgsteal_kswapd", &VmStat::pgsteal},
+        {"pgsteal_direct", &VmStat::pgsteal},
+        {"pgsteal_khugepaged", &VmStat::pgsteal},
+        {"pgsteal_proactive", &VmStat::pgsteal},
+        {"allocstall_dma", &VmStat::allocstall},
+        {"allocstall_dma32", &VmStat::allocstall},
+        {"allocstall_normal", &VmStat::allocstall},
+        {"allocstall_movable", &VmStat::allocstall},
+        {"allocstall_device", &VmStat::allocstall},
+        {"workingset_refault", &VmStat::workingset_refault}, // before 5.9
+        {"workingset_refault_anon", &VmStat::workingset_refault},
+        {"workingset_refault_file", &VmStat::workingset_refault},
+        {"oom_kill", &VmStat::oom_kill},
+    };
+    out = VmStat{};
+    pmr::string buf(mr);
+    if (!read_file("/proc/vmstat", buf)) return false;
+    // one "name value" pair per line
+    string_view text(buf);
+    while (!text.empty()) {
+        size_t blank = text.find(' ');
+        if (blank == string_view::npos) break;
+        string_view name = text.substr(0, blank);
+        text.remove_prefix(blank);
+        unsigned long long value = next_ull(text);
+        for (const auto &c : counters)
+            if (c.first == name) {
+                out.*c.second += value;
+                break;
+            }
+        if (!text.empty()) text.remove_prefix(1); // '\n'
+    }
+    return true;
+}
+
+vector<BuddyZone> read_buddyinfo() {
+    vector<BuddyZone> zones;
+    pmr::string buf;
+    if (!read_file("/proc/buddyinfo", buf)) return zones;
+    // Node 0, zone   Normal      2   2951   1953 ...
+    string_view text(buf);
+    while (text.rfind("Node ", 0) == 0) {
+        BuddyZone z;
+        text.remove_prefix(5);
+        z.node = (int)next_ull(text);
+        size_t at = text.find("zone");
+        if (at == string_view::npos) break;
+        text.remove_prefix(at + 4);
+        size_t start = text.find_first_not_of(' ');
+        size_t end = text.find(' ', start);
+        if (start == string_view::npos || end == string_view::npos) break;
+        z.zone = string(text.substr(start, end - start));
+        text.remove_prefix(end);
+        uint64_t v[32];
+        size_t used = 0;
+        size_t n = scan_fields(text, v, 32, &used);
+        z.free.assign(v, v + n);
+        text.remove_prefix(used);
+        zones.push_back(move(z));
+    }
+    return zones;
+}
+
+string thp_setting(const char *name) {
+    // "always [madvise] never"
+    char path[96];
+    snprintf(path, sizeof path, "/sys/kernel/mm/transparent_hugepage/%s", name);
+    pmr::string buf;
+    if (!read_file(path, buf)) return "";
+    size_t open = buf.find('['), close = buf.find(']');
+    if (open == pmr::string::npos || close == pmr::string::npos || close < open) return "";
+    return string(buf.substr(open + 1, close - open - 1));
+}
+
+bool delay_accounting_enabled() {
+    pmr::string buf;
+    if (read_file("/proc/sys/kernel/task_delayacct", buf)) return !buf.empty() && buf[0] != '0';
+    // before 5.14 accounting was on by default
+    if (!read_file("/proc/cmdline", buf)) return true;
+    return buf.find("nodelayacct") == pmr::string::npos;
+}
+
+HostCounters read_host_counters(unsigned fields, pmr::memory_resource *mr) {
+    HostCounters h;
+    h.at = chrono::steady_clock::now();
+    h.cpu = read_cpu_line(mr);
+    pmr::string meminfo(mr);
+    read_file("/proc/meminfo", meminfo);
+    h.mem_available = meminfo_value(meminfo, "MemAvailable:");
+    h.mem_free = meminfo_value(meminfo, "MemFree:");
+    h.has_vm = read_vmstat(h.vm, mr);
+    if (fields & PF_BLKIO) h.delay_acct = delay_accounting_enabled();
+    return h;
+}
+
+const string &uid_to_user(uid_t uid) {
+    static unordered_map<uid_t, string> names;
+    auto it = names.find(uid);
+    if (it != names.end()) return it->second;
+    struct passwd *pw = getpwuid(uid);
+    return names[uid] = pw ? string(pw->pw_name) : to_string(uid);
+}
+
+bool is_number(const string &s) {
+    for (char c : s) if (!isdigit(c)) return false;
+    return true;
+}
+
+void read_proc_files(pid_t pid, ProcFiles &f, unsigned fields) {
+    char path[64];
+
+    // cmdline (first argument), falling back to comm for kernel threads
+    snprintf(path, sizeof path, "/proc/%d/cmdline", (int)pid);
+    f.has_cmd = (fields & PF_CMD) && read_file(path, f.cmd);
+    if (f.has_cmd) {
+        f.cmd.resize(min(f.cmd.find('\0'), f.cmd.size()));
+        if (f.cmd.empty()) {
+            snprintf(path, sizeof path, "/proc/%d/comm", (int)pid);
+            if (read_file(path, f.cmd)) f.cmd.resize(min(f.cmd.find('\n'), f.cmd.size()));
+        }
+    }
+    snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+    f.has_stat = read_file(path, f.stat);
+    snprintf(path, sizeof path, "/proc/%d/status", (int)pid);
+    f.has_status = (fields & PF_USER) && read_file(path, f.status);
+    // storage I/O counters (only readable for our own processes unless root)
+    snprintf(path, sizeof path, "/proc/%d/io", (int)pid);
+    f.has_io = (fields & PF_IO) && read_file(path, f.io);
+}
+
+void parse_proc(pid_t pid, const ProcFiles &f, ProcSnapshot &p, StringPool &pool) {
+    p.pid = pid;
+    p.cpu_percent = 0.0;
+    p.mem_percent = 0.0;
+    p.cmd = f.has_cmd ? pool.intern(f.cmd) : 0;
+
+    if (f.has_stat) {
+        // fields: pid (1) comm (2) state (3) ... utime (14) stime (15) ... starttime (22) rss (24)
+        // ... delayacct_blkio_ticks (42); comm may contain spaces and parentheses, so count
+        // fields from the last ')'
+        const pmr::string &buf = f.stat;
+        size_t close_paren = buf.rfind(')');
+        if (close_paren != pmr::string::npos && close_paren + 4 < buf.size()) {
+            p.state = buf[close_paren + 2];
+            uint64_t v[39] = {}; // v[i] = field i + 4
+            scan_fields(string_view(buf).substr(close_paren + 4), v, 39); // skip ") S "
+            long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+            p.utime = v[10];
+            p.stime = v[11];
+            p.starttime = v[18];
+            p.rss = v[20] * page_size_kb; // in KB
+            p.blkio_ticks = v[38];
+        }
+    }
+
+    // status for uid
+    if (f.has_status) {
+        string_view status(f.status);
+        size_t at = status.find("\nUid:");
+        if (at != string_view::npos) {
+            string_view rest = status.substr(at + 5);
+            p.user = pool.intern(uid_to_user((uid_t)next_ull(rest)));
+        }
+    }
+
+    if (f.has_io) {
+        p.io_read = meminfo_value(f.io, "read_bytes:");
+        p.io_write = meminfo_value(f.io, "write_bytes:");
+    } else {
+        p.io_read = p.io_write = 0;
+    }
+}
+
+template <size_t... Masks>
+static constexpr array<ProcParser, sizeof...(Masks)> make_proc_parsers(index_sequence<Masks...>) {
+    return {&parse_proc_fields<Masks>...};
+}
+
+ProcParser proc_parser(unsigned fields) {
+    static constexpr auto parsers = make_proc_parsers(make_index_sequence<PF_ALL + 1>());
+    return parsers[fields & PF_ALL];
+}
+
+void read_proc(pid_t pid, ProcSnapshot &p, ProcFiles &files, unsigned fields, StringPool &pool) {
+    read_proc_files(pid, files, fields);
+    proc_parser(fields)(pid, files, p, pool);
+}
+
+int read_oom_score(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/oom_score", (int)pid);
+    char buf[16];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof buf - 1);
+    close(fd);
+    if (n <= 0 || buf[0] < '0' || buf[0] > '9') return -1;
+    string_view text(buf, n);
+    return (int)next_ull(text);
+}
+
+static bool is_hex(const string &s) {
+    for (char c : s) if (!isxdigit((unsigned char)c)) return false;
+    return !s.empty();
+}
+
+static bool is_hex_id(const string &s) {
+    return s.size() >= 32 && is_hex(s);
+}
+
+// Strips a runtime prefix/suffix from one cgroup path component and returns the
+// container ID it names, e.g. "cri-containerd-<id>.scope", "docker-<id>.scope",
+// "crio-<id>", or a bare "<id>" (cgroupfs driver). Empty if it is not a container.
+static string container_id_of(string comp) {
+    if (comp.size() > 6 && comp.compare(comp.size() - 6, 6, ".scope") == 0) comp.resize(comp.size() - 6);
+    size_t sep = comp.find_last_of("-:");
+    if (sep != string::npos) comp = comp.substr(sep + 1);
+    return is_hex_id(comp) ? comp : string();
+}
+
+string cgroup_label(const string &path) {
+    vector<string> comps;
+    stringstream ss(path);
+    string comp;
+    while (getline(ss, comp, '/')) if (!comp.empty()) comps.push_back(comp);
+    if (comps.empty()) return "-";
+
+    string pod, ctr;
+    for (const string &c : comps) {
+        if (c.rfind("kubepods", 0) == 0 || c.rfind("pod", 0) == 0) {
+            // "pod<uid>" (cgroupfs) or "kubepods-<qos>-pod<uid>.slice" (systemd)
+            size_t at = c.rfind("pod");
+            string uid = c.substr(at + 3, 8);
+            if (uid.size() == 8 && is_hex(uid)) pod = uid;
+            continue;
+        }
+        string id = container_id_of(c);
+        if (!id.empty()) ctr = id.substr(0, 12);
+    }
+    if (!ctr.empty()) return pod.empty() ? "ctr:" + ctr : pod + "/" + ctr;
+
+    for (auto it = comps.rbegin(); it != comps.rend(); ++it) {
+        const string &c = *it;
+        for (const char *suffix : {".service", ".scope", ".socket", ".mount"}) {
+            size_t n = strlen(suffix);
+            if (c.size() > n && c.compare(c.size() - n, n, suffix) == 0) return c;
+        }
+    }
+    return comps.back();
+}
+
+string read_cgroup_path(pid_t pid) {
+    ifstream f("/proc/" + to_string(pid) + "/cgroup");
+    string line, unified, systemd, other;
+    while (getline(f, line)) {
+        // Example: 0::/system.slice/nginx.service
+        size_t c1 = line.find(':');
+        size_t c2 = c1 == string::npos ? string::npos : line.find(':', c1 + 1);
+        if (c2 == string::npos) continue;
+        string controllers = line.substr(c1 + 1, c2 - c1 - 1);
+        string path = line.substr(c2 + 1);
+        if (path.empty() || path == "/") continue;
+        if (line.compare(0, c1, "0") == 0 && controllers.empty()) unified = path;
+        else if (controllers == "name=systemd") systemd = path;
+        else if (other.empty()) other = path;
+    }
+    if (!unified.empty()) return unified;
+    if (!systemd.empty()) return systemd;
+    return other.empty() ? "/" : other;
+}
+
+pmr::vector<pid_t> list_pids(pmr::memory_resource *mr) {
+    pmr::vector<pid_t> pids(mr);
+    pids.reserve(1024);
+    DIR *d = opendir("/proc");
+    if (!d) return pids;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (entry->d_type == DT_DIR) {
+            const char *name = entry->d_name;
+            if (name[0] >= '1' && name[0] <= '9' && is_number(name)) {
+                pids.push_back(atoi(name));
+            }
+        }
+    }
+    closedir(d);
+    return pids;
+}
+
+uint64_t unix_ms() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void xor_encode(BitWriter &w, XorState &st, double value) {
+    uint64_t bits = f64_bits(value);
+    uint64_t x = bits ^ st.prev;
+    st.prev = bits;
+    if (x == 0) {
+        w.put(0, 1);
+        return;
+    }
+    int lead = min(__builtin_clzll(x), 31), trail = __builtin_ctzll(x);
+    if (st.lead >= 0 && lead >= st.lead && trail >= st.trail) {
+        // fits in the previous window: '10' + window bits
+        w.put(2, 2);
+        w.put(x >> st.trail, 64 - st.lead - st.trail);
+        return;
+    }
+    // '11' + 5 bits leading zeros + 6 bits (length - 1) + meaningful bits
+    int len = 64 - lead - trail;
+    w.put(3, 2);
+    w.put(lead, 5);
+    w.put(len - 1, 6);
+    w.put(x >> trail, len);
+    st.lead = lead;
+    st.trail = trail;
+}
+
+double xor_decode(BitReader &r, XorState &st) {
+    if (r.get(1) == 1) {
+        if (r.get(1) == 1) {
+            st.lead = (int)r.get(5);
+            int len = (int)r.get(6) + 1;
+            st.trail = 64 - st.lead - len;
+            if (st.trail < 0) {
+                r.ok = false;
+                return 0.0;
+            }
+        } else if (st.lead < 0) {
+            r.ok = false;
+            return 0.0;
+        }
+        st.prev ^= r.get(64 - st.lead - st.trail) << st.trail;
+    }
+    return bits_f64(st.prev);
+}
+
+void dod_encode(BitWriter &w, DodState &st, int64_t t) {
+    int64_t delta = t - st.prev;
+    int64_t dod = delta - st.prev_delta;
+    st.prev = t;
+    st.prev_delta = delta;
+    if (dod == 0) w.put(0, 1);
+    else if (dod >= -63 && dod <= 64) { w.put(2, 2); w.put(dod + 63, 7); }
+    else if (dod >= -255 && dod <= 256) { w.put(6, 3); w.put(dod + 255, 9); }
+    else if (dod >= -2047 && dod <= 2048) { w.put(14, 4); w.put(dod + 2047, 12); }
+    else { w.put(15, 4); w.put((uint64_t)dod, 64); }
+}
+
+int64_t dod_decode(BitReader &r, DodState &st) {
+    int64_t dod;
+    if (r.get(1) == 0) dod = 0;
+    else if (r.get(1) == 0) dod = (int64_t)r.get(7) - 63;
+    else if (r.get(1) == 0) dod = (int64_t)r.get(9) - 255;
+    else if (r.get(1) == 0) dod = (int64_t)r.get(12) - 2047;
+    else dod = (int64_t)r.get(64);
+    st.prev_delta += dod;
+    st.prev += st.prev_delta;
+    return st.prev;
+}
+
+static uint32_t hundredths(double percent) { return (uint32_t)max(0LL, llround(percent * 100.0)); }
+
+void make_snapshot(HostSnapshot &s, uint64_t seq, const string &host, uint64_t ts_ms, const Sample &sample,
+                   const vector<const ProcSnapshot *> &rows, size_t top_k) {
+    s.seq = seq;
+    s.host = host;
+    s.ts_ms = ts_ms;
+    s.cpu_usage = hundredths(sample.cpu_usage);
+    s.mem_total = sample.mem_total;
+    s.mem_used = sample.mem_used;
+    s.nprocs = sample.procs.size();
+    size_t n = top_k ? min(top_k, rows.size()) : rows.size();
+    s.rows.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const ProcSnapshot &p = *rows[i];
+        FleetRow &r = s.rows[i];
+        r.pid = p.pid;
+        r.starttime = p.starttime;
+        r.cpu = hundredths(p.cpu_percent);
+        r.mem = hundredths(p.mem_percent);
+        r.rss_kb = p.rss;
+        r.user.assign(strings.str(p.user));
+        r.unit.assign(strings.str(p.unit));
+        r.cmd.assign(strings.str(p.cmd));
+    }
+    sort(s.rows.begin(), s.rows.end(), [](const FleetRow &a, const FleetRow &b) { return a.pid < b.pid; });
+}
+
+void encode_frame(ByteWriter &w, const HostSnapshot &cur, const HostSnapshot *base) {
+    size_t len_at = w.buf.size();
+    w.u32(0); // patched below
+    w.u8(base ? 'D' : 'K');
+    w.varint(cur.seq);
+    if (base) {
+        w.varint(base->seq);
+        w.svarint((int64_t)cur.ts_ms - (int64_t)base->ts_ms);
+        w.varint(cur.cpu_usage);
+        w.svarint((int64_t)cur.mem_total - (int64_t)base->mem_total);
+        w.svarint((int64_t)cur.mem_used - (int64_t)base->mem_used);
+        w.svarint((int64_t)cur.nprocs - (int64_t)base->nprocs);
+    } else {
+        w.bytes(cur.host);
+        w.varint(cur.ts_ms);
+        w.varint(cur.cpu_usage);
+        w.varint(cur.mem_total);
+        w.varint(cur.mem_used);
+        w.varint(cur.nprocs);
+    }
+
+    // merge-walk both pid-ordered row lists: removed rows first, then new and changed ones
+    static const vector<FleetRow> none;
+    const vector<FleetRow> &old = base ? base->rows : none;
+    size_t nremoved = 0;
+    ByteWriter removed, changed;
+    size_t nchanged = 0;
+    pid_t prev_removed = 0, prev_changed = 0;
+    size_t i = 0, j = 0;
+    while (i < old.size() || j < cur.rows.size()) {
+        if (j == cur.rows.size() || (i < old.size() && old[i].pid < cur.rows[j].pid)) {
+            removed.svarint((int64_t)old[i].pid - prev_removed);
+            prev_removed = old[i++].pid;
+            ++nremoved;
+            continue;
+        }
+        const FleetRow &r = cur.rows[j++];
+        const FleetRow *o = nullptr;
+        if (i < old.size() && old[i].pid == r.pid) o = &old[i++];
+        uint8_t flags;
+        if (!o || o->starttime != r.starttime) {
+            flags = WIRE_NEW;
+        } else {
+            flags = (o->cpu != r.cpu ? WIRE_CPU : 0) | (o->mem != r.mem ? WIRE_MEM : 0) |
+                    (o->rss_kb != r.rss_kb ? WIRE_RSS : 0) | (o->user != r.user ? WIRE_USER : 0) |
+                    (o->unit != r.unit ? WIRE_UNIT : 0) | (o->cmd != r.cmd ? WIRE_CMD : 0);
+            if (!flags) continue;
+        }
+        changed.svarint((int64_t)r.pid - prev_changed);
+        prev_changed = r.pid;
+        changed.u8(flags);
+        if (flags & WIRE_NEW) {
+            changed.varint(r.starttime);
+            changed.varint(r.cpu);
+            changed.varint(r.mem);
+            changed.varint(r.rss_kb);
+            changed.bytes(r.user);
+            changed.bytes(r.unit);
+            changed.bytes(r.cmd);
+        } else {
+            if (flags & WIRE_CPU) changed.varint(r.cpu);
+            if (flags & WIRE_MEM) changed.varint(r.mem);
+            if (flags & WIRE_RSS) changed.svarint((int64_t)r.rss_kb - (int64_t)o->rss_kb);
+            if (flags & WIRE_USER) changed.bytes(r.user);
+            if (flags & WIRE_UNIT) changed.bytes(r.unit);
+            if (flags & WIRE_CMD) changed.bytes(r.cmd);
+        }
+        ++nchanged;
+    }
+    w.varint(nremoved);
+    w.buf += removed.buf;
+    w.varint(nchanged);
+    w.buf += changed.buf;
+    uint32_t len = (uint32_t)(w.buf.size() - len_at - 4);
+    for (int k = 0; k < 4; ++k) w.buf[len_at + k] = (char)(len >> (8 * k));
+}
+
+void encode_ack(ByteWriter &w, uint64_t seq) {
+    ByteWriter p;
+    p.u8('A');
+    p.varint(seq);
+    w.u32((uint32_t)p.buf.size());
+    w.buf += p.buf;
+}
@@ -0,0 +1,963 @@
+// sysmon_core.h
+// Collectors, process table, string pool and the delta coders shared by the
+// sysmon tool and libsysmon. Internal: embedders use sysmon.h.
+
+#ifndef SYSMON_CORE_H
+#define SYSMON_CORE_H
+
+#include <bits/stdc++.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <fcntl.h>
+#include <memory_resource>
+
+using namespace std;
+
+struct CpuSnapshot {
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice;
+    unsigned long long total() const {
+        return user + nice + system + idle + iowait + irq + softirq + steal + guest + guest_nice;
+    }
+    unsigned long long idleAll() const {
+        return idle + iowait;
+    }
+};
+
+// Handle of a string in the StringPool; 0 is the empty string.
+using StrId = uint32_t;
+
+// Strings (user, cmd, unit) are StrId handles into the global string pool, so
+// the snapshot is trivially copyable and comparing two names is an integer compare.
+struct ProcSnapshot {
+    pid_t pid = 0;
+    StrId user = 0;
+    StrId cmd = 0;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    unsigned long long total_time() const { return utime + stime; }
+    unsigned long rss = 0; // in KB (approx)
+    unsigned long long starttime = 0; // clock ticks after boot; (pid, starttime) names one incarnation
+    char state = '?'; // R, S, D, Z, ...
+    StrId unit = 0; // container ID or systemd unit
+    unsigned long long io_read = 0, io_write = 0; // storage I/O bytes, 0 if /proc/<pid>/io is not readable
+    unsigned long long blkio_ticks = 0; // clock ticks spent waiting for block I/O (delay accounting)
+    double cpu_percent = 0.0;
+    double mem_percent = 0.0;
+    double io_wait_percent = 0.0; // share of the interval spent waiting for block I/O
+};
+
+// memory_resource that forwards to another one and counts what went through it.
+class CountingResource : public pmr::memory_resource {
+public:
+    explicit CountingResource(pmr::memory_resource *next) : next(next) {}
+    size_t bytes = 0;
+
+private:
+    pmr::memory_resource *next;
+    void *do_allocate(size_t n, size_t align) override {
+        bytes += n;
+        return next->allocate(n, align);
+    }
+    void do_deallocate(void *p, size_t n, size_t align) override { next->deallocate(p, n, align); }
+    bool do_is_equal(const pmr::memory_resource &o) const noexcept override { return this == &o; }
+};
+
+// Hash-consed pool that stores each distinct string once. Entries are
+// reclaimed by epoch: every tick re-interns (or touches) the strings it still
+// uses, and collect() frees those unused for a whole epoch, so handles copied
+// from the previous tick stay valid. Freed handles are recycled.
+class StringPool {
+public:
+    StringPool() { intern(""); }
+
+    StrId intern(string_view s) {
+        auto it = index.find(s);
+        if (it != index.end()) {
+            entries[it->second].epoch = epoch;
+            return it->second;
+        }
+        StrId id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = (StrId)entries.size();
+            entries.emplace_back();
+        }
+        Entry &e = entries[id];
+        e.text.assign(s.data(), s.size());
+        e.epoch = epoch;
+        e.live = true;
+        index.emplace(string_view(e.text), id);
+        bytes += e.text.size();
+        return id;
+    }
+
+    // Handle of s if it is in the pool, else 0 (which is also the empty string).
+    StrId find(string_view s) const {
+        auto it = index.find(s);
+        return it == index.end() ? 0 : it->second;
+    }
+
+    // Keeps id alive for this epoch without hashing its text.
+    void touch(StrId id) { entries[id].epoch = epoch; }
+
+    const char *c_str(StrId id) const { return entries[id].text.c_str(); }
+    string_view str(StrId id) const { return entries[id].text; }
+
+    // Frees the entries not used in this or the previous epoch and starts a new epoch.
+    void collect() {
+        for (StrId id = 1; id < entries.size(); ++id) {
+            Entry &e = entries[id];
+            if (!e.live || e.epoch + 1 >= epoch) continue;
+            index.erase(string_view(e.text));
+            bytes -= e.text.size();
+            e.text.clear();
+            e.live = false;
+            free_ids.push_back(id);
+        }
+        entries[0].epoch = ++epoch;
+    }
+
+    size_t count() const { return index.size(); }
+    size_t text_bytes() const { return bytes; }
+
+private:
+    struct Entry {
+        string text;
+        unsigned long long epoch = 0;
+        bool live = false;
+    };
+    deque<Entry> entries; // deque: growing never moves the strings the index points into
+    vector<StrId> free_ids;
+    unordered_map<string_view, StrId> index;
+    unsigned long long epoch = 1;
+    size_t bytes = 0;
+};
+
+extern StringPool strings; // user names, command lines and units of all processes
+
+// Monotonic arena for data that only lives for one tick: file buffers, the
+// process list and its strings. reset() drops everything at once. If a tick
+// overflowed the buffer into the heap, the next reset grows the buffer, so
+// steady-state collection never touches the global heap.
+class TickArena {
+public:
+    explicit TickArena(size_t initial = 256 * 1024)
+        : buffer(initial), upstream(pmr::new_delete_resource()), front(nullptr) {
+        rebuild();
+    }
+
+    void reset() {
+        size_t used = front.bytes;
+        if (upstream.bytes > 0) buffer.resize(max(buffer.size() * 2, used + used / 2));
+        rebuild();
+    }
+
+    pmr::memory_resource *resource() { return &front; }
+    size_t used() const { return front.bytes; }
+    size_t capacity() const { return buffer.size(); }
+
+private:
+    vector<char> buffer;
+    CountingResource upstream; // heap allocations made when the buffer runs out
+    optional<pmr::monotonic_buffer_resource> mono;
+    CountingResource front; // everything handed out this tick
+
+    void rebuild() {
+        mono.reset();
+        upstream.bytes = 0;
+        mono.emplace(buffer.data(), buffer.size(), &upstream);
+        front = CountingResource(&*mono);
+    }
+};
+
+static const int REFRESH_INTERVAL = 2; // seconds
+extern long Hertz; // clock ticks per second
+extern unsigned long long total_mem_kb_cache; // MemTotal, read once at startup
+
+// Reads a whole (proc) file into out with plain read(2); no stream buffers.
+bool read_file(const char *path, pmr::string &out);
+
+// Parses the next unsigned decimal in s (skipping leading blanks) and advances s past it.
+inline unsigned long long next_ull(string_view &s) {
+    size_t i = 0;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) ++i;
+    unsigned long long v = 0;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') v = v * 10 + (s[i++] - '0');
+    while (i < s.size() && s[i] != ' ' && s[i] != '\t' && s[i] != '\n') ++i; // e.g. "-1"
+    s.remove_prefix(i);
+    return v;
+}
+
+// Numeric field scanner shared by the /proc parsers. Decodes the blank-
+// separated fields of the first line of s into out: each field's leading
+// decimal digits (a leading '-' negates modulo 2^64), 0 for a field without
+// digits. Stops at the end of the line or after max fields and returns the
+// number decoded; *consumed is set to the bytes used (through the newline
+// if the line ended). Uses AVX2 or SSE4.2 when the CPU has them.
+size_t scan_fields(string_view s, uint64_t *out, size_t max, size_t *consumed = nullptr);
+
+enum class ScanIsa { Scalar, Sse42, Avx2 };
+ScanIsa scan_isa(); // the kernel scan_fields uses
+bool set_scan_isa(ScanIsa isa); // false if the CPU lacks it
+const char *scan_isa_name(ScanIsa isa);
+
+// Value of a "Key:   123 kB" line in a meminfo-style file, 0 if absent.
+unsigned long long meminfo_value(string_view text, string_view key);
+
+CpuSnapshot read_cpu_line(pmr::memory_resource *mr = pmr::get_default_resource());
+
+unsigned long long read_total_memory_kb();
+
+// One NUMA node from /sys/devices/system/node/node<id>: memory in kB, its
+// numastat allocation counters (pages since boot) and its CPUs.
+struct NumaNode {
+    int id = 0;
+    unsigned long long mem_total = 0, mem_free = 0, file_pages = 0;
+    unsigned long long numa_hit = 0;     // allocated here as intended
+    unsigned long long numa_miss = 0;    // allocated here though another node was preferred
+    unsigned long long numa_foreign = 0; // meant for here but allocated on another node
+    vector<int> cpus;
+};
+
+// All nodes in id order; empty if the kernel has no NUMA support (a machine
+// with one node still has node0).
+vector<NumaNode> read_numa_nodes();
+
+// CPU numbers of a cpulist such as "0-3,8-11".
+vector<int> parse_cpu_list(string_view s);
+
+// cpu_nodes(nodes)[c] is the node of CPU c, -1 for a CPU in no node.
+vector<int> cpu_nodes(const vector<NumaNode> &nodes);
+
+// Where one process's memory and threads are, indexed by node id.
+struct ProcNumaUsage {
+    vector<unsigned long long> node_kb; // resident pages from numa_maps
+    vector<unsigned> node_threads;      // threads whose last CPU is on the node
+};
+
+// Reads /proc/<pid>/numa_maps and the last CPU of each thread. numa_maps walks
+// the page tables of the whole address space, so this is costly for large
+// processes; call it for a few processes at a time. False if pid is gone or
+// numa_maps is not readable.
+bool read_proc_numa(pid_t pid, const vector<int> &cpu_node, ProcNumaUsage &out);
+
+// Counters of /proc/vmstat, cumulative since boot (events, or pages).
+struct VmStat {
+    unsigned long long thp_fault_alloc = 0, thp_fault_fallback = 0; // faults given a huge page / given 4K pages
+    unsigned long long thp_collapse_alloc = 0; // small pages merged by khugepaged
+    unsigned long long thp_split_page = 0;
+    unsigned long long compact_stall = 0; // allocations that stalled in direct compaction
+    unsigned long long compact_fail = 0, compact_success = 0;
+    // reclaim: pages scanned by kswapd and by allocating tasks (direct
+    // reclaim), pages reclaimed by any path, allocations that had to reclaim,
+    // and evicted pages faulted back in soon after
+    unsigned long long pgscan_kswapd = 0, pgscan_direct = 0, pgsteal = 0;
+    unsigned long long allocstall = 0, workingset_refault = 0;
+    unsigned long long oom_kill = 0; // processes killed by the OOM killer (host or cgroup limit)
+};
+
+bool read_vmstat(VmStat &out, pmr::memory_resource *mr = pmr::get_default_resource());
+
+// Free blocks of one zone from /proc/buddyinfo; free[o] counts blocks of 2^o pages.
+struct BuddyZone {
+    int node = 0;
+    string zone;
+    vector<unsigned long long> free;
+};
+
+vector<BuddyZone> read_buddyinfo();
+
+// Selected value of /sys/kernel/mm/transparent_hugepage/<name> ("enabled",
+// "defrag"), e.g. "madvise"; empty without THP support.
+string thp_setting(const char *name);
+
+// Whether the kernel keeps per-task delay accounting (the block I/O delay of
+// /proc/<pid>/stat): the kernel.task_delayacct sysctl, or on kernels without
+// it, on unless booted with nodelayacct. Off, every process reports 0.
+bool delay_accounting_enabled();
+
+// getpwuid() is slow and allocates, so names are resolved once per uid.
+const string &uid_to_user(uid_t uid);
+
+bool is_number(const string &s);
+
+// Optional per-process fields. PID, CPU times and start time are always
+// parsed (the deltas need them); a view asks only for the fields its columns
+// show, and files holding none of them are not even read.
+enum ProcField : unsigned {
+    PF_CMD = 1,   // cmdline / comm
+    PF_USER = 2,  // status (Uid)
+    PF_STATE = 4,
+    PF_RSS = 8,   // and %MEM
+    PF_IO = 16,   // io
+    PF_BLKIO = 32, // block I/O delay (stat field 42)
+    PF_ALL = 63
+};
+
+// Raw contents of the /proc/<pid> files a ProcSnapshot is parsed from. The
+// buffers keep their capacity, so a reused ProcFiles reads without allocating.
+struct ProcFiles {
+    pmr::string cmd;    // first argument of cmdline, or comm for kernel threads
+    pmr::string stat, status, io;
+    bool has_cmd = false, has_stat = false, has_status = false, has_io = false;
+};
+
+// Reads the files of one process that hold the given ProcFields; plain I/O,
+// safe on any thread.
+void read_proc_files(pid_t pid, ProcFiles &f, unsigned fields = PF_ALL);
+
+// Fills p from files read by read_proc_files and interns its strings in pool.
+// The generic parser: decodes every stat field and every file that was read.
+void parse_proc(pid_t pid, const ProcFiles &f, ProcSnapshot &p, StringPool &pool = strings);
+
+// Parser specialized on a constant ProcField mask: fields outside Fields are
+// left at their defaults, stat is decoded only up to the last field the mask
+// needs, and the checks fold away at compile time.
+template <unsigned Fields>
+void parse_proc_fields(pid_t pid, const ProcFiles &f, ProcSnapshot &p, StringPool &pool) {
+    p.pid = pid;
+    p.cpu_percent = 0.0;
+    p.mem_percent = 0.0;
+    if constexpr ((Fields & PF_CMD) != 0) p.cmd = f.has_cmd ? pool.intern(f.cmd) : 0;
+
+    if (f.has_stat) {
+        // fields: pid (1) comm (2) state (3) ... utime (14) stime (15) ... starttime (22) rss (24)
+        // ... delayacct_blkio_ticks (42); comm may contain spaces and parentheses, so count
+        // fields from the last ')'
+        string_view stat(f.stat);
+        size_t close_paren = stat.rfind(')');
+        if (close_paren != string_view::npos && close_paren + 4 < stat.size()) {
+            if constexpr ((Fields & PF_STATE) != 0) p.state = stat[close_paren + 2];
+            // decode fields 4.. in bulk, up to the last one this mask needs
+            constexpr size_t need = (Fields & PF_BLKIO) != 0 ? 39 : (Fields & PF_RSS) != 0 ? 21 : 19;
+            uint64_t v[need] = {}; // v[i] = field i + 4
+            scan_fields(stat.substr(close_paren + 4), v, need); // skip ") S "
+            p.utime = v[10];
+            p.stime = v[11];
+            p.starttime = v[18];
+            if constexpr ((Fields & PF_RSS) != 0) {
+                static const long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+                p.rss = v[20] * page_size_kb; // in KB
+            }
+            if constexpr ((Fields & PF_BLKIO) != 0) p.blkio_ticks = v[38];
+        }
+    }
+
+    if constexpr ((Fields & PF_USER) != 0) {
+        if (f.has_status) {
+            string_view status(f.status);
+            size_t at = status.find("\nUid:");
+            if (at != string_view::npos) {
+                string_view rest = status.substr(at + 5);
+                p.user = pool.intern(uid_to_user((uid_t)next_ull(rest)));
+            }
+        }
+    }
+
+    if constexpr ((Fields & PF_IO) != 0) {
+        if (f.has_io) {
+            p.io_read = meminfo_value(f.io, "read_bytes:");
+            p.io_write = meminfo_value(f.io, "write_bytes:");
+        }
+    }
+}
+
+// The parse_proc_fields instantiation for a runtime field mask.
+using ProcParser = void (*)(pid_t, const ProcFiles &, ProcSnapshot &, StringPool &);
+ProcParser proc_parser(unsigned fields);
+
+// Fills p from /proc/<pid>, reading through the caller's buffers.
+void read_proc(pid_t pid, ProcSnapshot &p, ProcFiles &files, unsigned fields = PF_ALL, StringPool &pool = strings);
+
+// /proc/<pid>/oom_score (0..2000, who the OOM killer picks first), -1 if unreadable.
+int read_oom_score(pid_t pid);
+
+// Turns a cgroup path into a short label: "<pod>/<container>" for Kubernetes,
+// "ctr:<container>" for other runtimes, else the innermost systemd unit, else
+// the last path component ("-" for the root cgroup).
+string cgroup_label(const string &path);
+
+// Reads /proc/<pid>/cgroup and picks the most specific path: the unified (v2)
+// hierarchy if it is not the root, then name=systemd, then any v1 controller.
+string read_cgroup_path(pid_t pid);
+
+// Table indexed directly by PID: a directory of fixed-size pages, with pages
+// allocated only for PID ranges that are actually populated, so pid_max up to
+// 4M (2^22) costs a 4K-entry directory plus the pages in use. Each slot carries
+// the tick it was last written in; a slot is live for tick t iff stamp == t,
+// so nothing is cleared or rebuilt between ticks. Stamp 0 means empty.
+template <typename T>
+class PidTable {
+public:
+    struct Slot {
+        unsigned long long stamp = 0;
+        T value{};
+    };
+    static constexpr size_t PAGE_BITS = 10;
+    static constexpr size_t PAGE_SIZE = size_t(1) << PAGE_BITS;
+    static constexpr size_t PID_LIMIT = size_t(1) << 22; // kernel PID_MAX_LIMIT on 64-bit
+
+    explicit PidTable(size_t pid_max = read_pid_max())
+        : pages((min(max(pid_max, PAGE_SIZE), PID_LIMIT) + PAGE_SIZE - 1) >> PAGE_BITS) {}
+
+    // Slot for pid if it was written during tick `stamp`, else nullptr.
+    Slot *find(pid_t pid, unsigned long long stamp) {
+        size_t idx = (size_t)pid;
+        size_t page = idx >> PAGE_BITS;
+        if (page >= pages.size() || !pages[page]) return nullptr;
+        Slot &s = pages[page][idx & (PAGE_SIZE - 1)];
+        return s.stamp == stamp ? &s : nullptr;
+    }
+
+    // Slot for pid whatever its stamp, allocating its page on first use.
+    Slot &slot(pid_t pid) {
+        size_t idx = (size_t)pid;
+        size_t page = idx >> PAGE_BITS;
+        if (page >= pages.size()) pages.resize(page + 1);
+        if (!pages[page]) pages[page].reset(new Slot[PAGE_SIZE]);
+        return pages[page][idx & (PAGE_SIZE - 1)];
+    }
+
+    // Calls f(pid, slot) for every non-empty slot of the populated pages.
+    template <typename F>
+    void for_each(F f) {
+        for (size_t page = 0; page < pages.size(); ++page) {
+            if (!pages[page]) continue;
+            for (size_t i = 0; i < PAGE_SIZE; ++i) {
+                Slot &s = pages[page][i];
+                if (s.stamp != 0) f((pid_t)((page << PAGE_BITS) | i), s);
+            }
+        }
+    }
+
+    static size_t read_pid_max() {
+        ifstream f("/proc/sys/kernel/pid_max");
+        size_t n = 0;
+        if (!(f >> n)) n = 32768;
+        return n;
+    }
+
+private:
+    vector<unique_ptr<Slot[]>> pages;
+};
+
+// Caches the cgroup label of each process incarnation (pid + starttime), since
+// cgroup membership rarely changes, and keeps a reverse index unit -> pids so
+// "all processes of unit X" is a single lookup.
+struct CgroupCache {
+    struct Entry {
+        unsigned long long starttime;
+        StrId unit;
+    };
+    PidTable<Entry> by_pid; // slot stamp = tick of the last lookup
+    unordered_map<StrId, unordered_set<pid_t>> by_unit;
+    unsigned long long tick = 1;
+    StringPool *pool = &strings; // where the labels are interned; the owning Collector's
+
+    StrId lookup(pid_t pid, unsigned long long starttime) {
+        auto &s = by_pid.slot(pid);
+        if (s.stamp != 0 && s.value.starttime != starttime) {
+            // pid was reused by a new process
+            unlink(pid, s.value.unit);
+            s.stamp = 0;
+        }
+        if (s.stamp == 0) {
+            s.value.starttime = starttime;
+            s.value.unit = pool->intern(cgroup_label(read_cgroup_path(pid)));
+            by_unit[s.value.unit].insert(pid);
+        } else {
+            pool->touch(s.value.unit);
+        }
+        s.stamp = tick;
+        return s.value.unit;
+    }
+
+    const unordered_set<pid_t> *members(StrId unit) const {
+        auto it = by_unit.find(unit);
+        return it == by_unit.end() ? nullptr : &it->second;
+    }
+
+    // Forgets processes that were not looked up during the current tick.
+    void sweep() {
+        by_pid.for_each([&](pid_t pid, PidTable<Entry>::Slot &s) {
+            if (s.stamp != tick) {
+                unlink(pid, s.value.unit);
+                s.stamp = 0;
+            }
+        });
+        ++tick;
+    }
+
+private:
+    void unlink(pid_t pid, StrId unit) {
+        auto it = by_unit.find(unit);
+        if (it == by_unit.end()) return;
+        it->second.erase(pid);
+        if (it->second.empty()) by_unit.erase(it);
+    }
+};
+
+pmr::vector<pid_t> list_pids(pmr::memory_resource *mr);
+
+// Per-second rates of the reclaim counters of VmStat between two ticks
+// (pages, except allocstall); valid is false on the first tick.
+struct ReclaimRates {
+    bool valid = false;
+    double pgscan_kswapd = 0, pgscan_direct = 0, pgsteal = 0, allocstall = 0, workingset_refault = 0;
+};
+
+// Host-wide figures and the process list of one refresh. The process list is
+// allocated from the tick arena and must not outlive the next arena reset.
+struct Sample {
+    double cpu_usage = 0.0; // percent
+    unsigned long long mem_total = 0, mem_used = 0; // kB
+    ReclaimRates reclaim;
+    unsigned long long oom_kills = 0; // since boot, from /proc/vmstat
+    bool io_delay = false; // PF_BLKIO was read with delay accounting on: io_wait_percent is meaningful
+    pmr::vector<ProcSnapshot> procs;
+
+    explicit Sample(pmr::memory_resource *mr) : procs(mr) {}
+};
+
+// Host-wide counters of one tick. Taken right before the tick's process
+// files are read, so host and per-process deltas span the same interval.
+struct HostCounters {
+    CpuSnapshot cpu{};
+    unsigned long long mem_available = 0, mem_free = 0; // kB
+    VmStat vm;
+    bool has_vm = false;
+    bool delay_acct = false; // only looked up when fields has PF_BLKIO
+    chrono::steady_clock::time_point at;
+};
+
+HostCounters read_host_counters(unsigned fields, pmr::memory_resource *mr);
+
+// State carried from one tick to the next: previous CPU counters and process
+// times (for deltas) and the cgroup cache. The snapshots' strings live in
+// pool, whose epoch end() advances: collectors that tick at different rates
+// need pools of their own, or one would free the other's strings.
+struct Collector {
+    explicit Collector(StringPool &pool = strings) : pool(&pool) { cgroups.pool = &pool; }
+
+    StringPool *pool;
+    CpuSnapshot prev_cpu = read_cpu_line();
+    PidTable<ProcSnapshot> proc_table; // this and the previous tick's snapshots
+    unsigned long long tick = 1;
+    CgroupCache cgroups;
+    pid_t only_pid = 0; // sample just this process (0 = all processes)
+    unsigned fields = PF_ALL; // optional ProcFields to read
+
+    ProcFiles files; // read buffers of collect()
+
+    void collect(Sample &out, pmr::memory_resource *mr) {
+        begin(out, mr);
+        // read processes
+        pmr::vector<pid_t> pids = only_pid ? pmr::vector<pid_t>(1, only_pid, mr) : list_pids(mr);
+        out.procs.reserve(pids.size());
+        for (pid_t pid : pids) {
+            ProcSnapshot &cur = out.procs.emplace_back();
+            read_proc(pid, cur, files, fields, *pool);
+            add(cur);
+        }
+        end();
+    }
+
+    // collect() in steps, for callers that read the process files themselves:
+    // begin() takes the CPU and memory sample, add() fills in the deltas of
+    // one process of out.procs and remembers it, end() closes the tick.
+    void begin(Sample &out, pmr::memory_resource *mr) { begin(out, read_host_counters(fields, mr)); }
+
+    // begin() on counters the caller took itself, before reading the files.
+    void begin(Sample &out, const HostCounters &host) {
+        cur_cpu = host.cpu;
+        unsigned long long prev_tot = prev_cpu.total();
+        unsigned long long cur_tot = cur_cpu.total();
+        tot_diff = cur_tot - prev_tot;
+        unsigned long long idle_diff = cur_cpu.idleAll() - prev_cpu.idleAll();
+        out.cpu_usage = 0.0;
+        if (tot_diff > 0) out.cpu_usage = 100.0 * (double)(tot_diff - idle_diff) / (double)tot_diff;
+
+        // memory
+        unsigned long long mem_total = total_mem_kb_cache;
+        out.mem_total = mem_total;
+        if (mem_total > host.mem_available) out.mem_used = mem_total - host.mem_available;
+        else out.mem_used = mem_total - host.mem_free;
+
+        interval_s = tick > 1 ? chrono::duration<double>(host.at - prev_begin_at).count() : 0.0;
+        prev_begin_at = host.at;
+        out.io_delay = (fields & PF_BLKIO) && host.delay_acct;
+
+        // reclaim activity since the previous tick
+        const VmStat &vm = host.vm;
+        out.reclaim = ReclaimRates{};
+        if (host.has_vm) {
+            double secs = chrono::duration<double>(host.at - prev_vm_at).count();
+            if (have_prev_vm && secs > 0) {
+                auto rate = [&](unsigned long long VmStat::*c) {
+                    return vm.*c >= prev_vm.*c ? (double)(vm.*c - prev_vm.*c) / secs : 0.0;
+                };
+                out.reclaim.valid = true;
+                out.reclaim.pgscan_kswapd = rate(&VmStat::pgscan_kswapd);
+                out.reclaim.pgscan_direct = rate(&VmStat::pgscan_direct);
+                out.reclaim.pgsteal = rate(&VmStat::pgsteal);
+                out.reclaim.allocstall = rate(&VmStat::allocstall);
+                out.reclaim.workingset_refault = rate(&VmStat::workingset_refault);
+            }
+            out.oom_kills = vm.oom_kill;
+            prev_vm = vm;
+            prev_vm_at = host.at;
+            have_prev_vm = true;
+        }
+        out.procs.clear();
+    }
+
+    void add(ProcSnapshot &cur) {
+        pid_t pid = cur.pid;
+        cur.unit = cgroups.lookup(pid, cur.starttime);
+        // compute cpu percent relative to previous snapshot
+        double cpu_pct = 0.0;
+        auto *prev = proc_table.find(pid, tick - 1);
+        if (prev && prev->value.starttime == cur.starttime) {
+            unsigned long long prev_total_time = prev->value.total_time();
+            unsigned long long cur_total_time = cur.total_time();
+            unsigned long long proc_time_diff = 0;
+            if (cur_total_time >= prev_total_time) proc_time_diff = cur_total_time - prev_total_time;
+            if (tot_diff > 0) {
+                // cpu % = (proc_time_diff / Hertz) / (tot_diff / Hertz) * 100
+                // simplified: proc_time_diff / tot_diff * 100
+                cpu_pct = 100.0 * (double)proc_time_diff / (double)tot_diff;
+            }
+        }
+        cur.cpu_percent = cpu_pct;
+        // block I/O wait %: delay ticks over the wall interval, summed over the threads
+        cur.io_wait_percent = 0.0;
+        if (prev && prev->value.starttime == cur.starttime && interval_s > 0 &&
+            cur.blkio_ticks >= prev->value.blkio_ticks)
+            cur.io_wait_percent =
+                100.0 * (double)(cur.blkio_ticks - prev->value.blkio_ticks) / (double)Hertz / interval_s;
+        // mem %
+        if (total_mem_kb_cache > 0) {
+            cur.mem_percent = 100.0 * (double)cur.rss / (double)total_mem_kb_cache;
+        } else cur.mem_percent = 0.0;
+        auto &slot = proc_table.slot(pid);
+        slot.stamp = tick;
+        slot.value = cur;
+    }
+
+    void end() {
+        // slots stamped with this tick become "previous" for the next one
+        ++tick;
+        prev_cpu = cur_cpu;
+        cgroups.sweep();
+        pool->collect();
+    }
+
+private:
+    CpuSnapshot cur_cpu{};
+    unsigned long long tot_diff = 0;
+    chrono::steady_clock::time_point prev_begin_at;
+    double interval_s = 0.0; // wall time between the host counters of the last two ticks
+    VmStat prev_vm;
+    chrono::steady_clock::time_point prev_vm_at;
+    bool have_prev_vm = false;
+};
+
+
+// Little-endian / varint encoders for the on-disk formats.
+struct ByteWriter {
+    string buf;
+
+    void u8(uint8_t v) { buf += (char)v; }
+    void u32(uint32_t v) { for (int i = 0; i < 4; ++i) buf += (char)(v >> (8 * i)); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; ++i) buf += (char)(v >> (8 * i)); }
+    void f64(double v) { uint64_t bits; memcpy(&bits, &v, 8); u64(bits); }
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            buf += (char)(v | 0x80);
+            v >>= 7;
+        }
+        buf += (char)v;
+    }
+    void svarint(int64_t v) { varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); } // zigzag
+    void bytes(string_view s) { varint(s.size()); buf.append(s.data(), s.size()); }
+};
+
+// Decoder counterpart; a read past the end sets ok = false and returns zeros.
+struct ByteReader {
+    string_view data;
+    bool ok = true;
+
+    explicit ByteReader(string_view d) : data(d) {}
+    bool need(size_t n) {
+        if (data.size() < n) ok = false;
+        return ok;
+    }
+    uint8_t u8() {
+        if (!need(1)) return 0;
+        uint8_t v = data[0];
+        data.remove_prefix(1);
+        return v;
+    }
+    uint32_t u32() {
+        if (!need(4)) return 0;
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= (uint32_t)(uint8_t)data[i] << (8 * i);
+        data.remove_prefix(4);
+        return v;
+    }
+    uint64_t u64() {
+        if (!need(8)) return 0;
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)(uint8_t)data[i] << (8 * i);
+        data.remove_prefix(8);
+        return v;
+    }
+    double f64() { uint64_t bits = u64(); double v; memcpy(&v, &bits, 8); return v; }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!need(1)) return 0;
+            uint8_t b = data[0];
+            data.remove_prefix(1);
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    int64_t svarint() { uint64_t v = varint(); return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+    string_view bytes() {
+        uint64_t n = varint();
+        if (!need(n)) return {};
+        string_view v = data.substr(0, n);
+        data.remove_prefix(n);
+        return v;
+    }
+};
+
+// ---- Gorilla-style series compression ----
+// Floats are XORed with the previous value of the same series and only the
+// meaningful bits are stored; timestamps are stored as delta-of-delta with
+// variable-size buckets (Pelkonen et al., "Gorilla", VLDB 2015). A series
+// sampled at a steady rate with slowly changing values costs a few bits per point.
+
+// MSB-first bit stream.
+struct BitWriter {
+    string buf;
+    int free_bits = 0; // unused low bits of the last byte
+
+    void put(uint64_t v, int nbits) {
+        while (nbits > 0) {
+            if (free_bits == 0) {
+                buf += '\0';
+                free_bits = 8;
+            }
+            int n = min(nbits, free_bits);
+            uint64_t chunk = (v >> (nbits - n)) & ((1ULL << n) - 1);
+            buf.back() |= (char)(chunk << (free_bits - n));
+            free_bits -= n;
+            nbits -= n;
+        }
+    }
+    void clear() {
+        buf.clear();
+        free_bits = 0;
+    }
+};
+
+struct BitReader {
+    string_view data;
+    size_t pos = 0; // in bits
+    bool ok = true;
+
+    explicit BitReader(string_view d) : data(d) {}
+    uint64_t get(int nbits) {
+        if (pos + nbits > data.size() * 8) {
+            ok = false;
+            return 0;
+        }
+        uint64_t v = 0;
+        while (nbits > 0) {
+            int avail = 8 - (int)(pos & 7);
+            int n = min(nbits, avail);
+            uint8_t byte = data[pos >> 3];
+            v = (v << n) | ((byte >> (avail - n)) & ((1u << n) - 1));
+            pos += n;
+            nbits -= n;
+        }
+        return v;
+    }
+};
+
+// Per-series state of the XOR float coder.
+struct XorState {
+    uint64_t prev = 0;
+    int lead = -1, trail = 0; // window of the last explicitly stored value
+};
+
+inline uint64_t f64_bits(double v) { uint64_t b; memcpy(&b, &v, 8); return b; }
+inline double bits_f64(uint64_t b) { double v; memcpy(&v, &b, 8); return v; }
+
+void xor_encode(BitWriter &w, XorState &st, double value);
+
+double xor_decode(BitReader &r, XorState &st);
+
+// Wall clock in Unix milliseconds.
+uint64_t unix_ms();
+
+// Per-series state of the delta-of-delta timestamp coder.
+struct DodState {
+    int64_t prev = 0, prev_delta = 0;
+};
+
+void dod_encode(BitWriter &w, DodState &st, int64_t t);
+
+int64_t dod_decode(BitReader &r, DodState &st);
+
+// ---- snapshot stream protocol ----
+// A headless agent samples like the TUI and streams its top-K processes to
+// every connected client. Messages in both directions are framed as u32
+// payload length + payload.
+//
+// Agent -> client, one snapshot per sample, coded against the last snapshot
+// the client acknowledged (or self-contained, a keyframe):
+//   u8 'K' | 'D', varint seq, D: varint base_seq
+//   K: bytes host, varint ts_ms, varint cpu_usage, varint mem_total,
+//      varint mem_used, varint nprocs
+//   D: svarint d(ts_ms), varint cpu_usage, svarint d(mem_total),
+//      svarint d(mem_used), svarint d(nprocs)
+//   varint nremoved, per removed row svarint d(pid)
+//   varint nrows, per new or changed row svarint d(pid), u8 flags,
+//     new:     varint starttime, varint cpu, varint mem, varint rss_kb, bytes user, unit, cmd
+//     changed: [varint cpu] [varint mem] [svarint d(rss_kb)] [bytes user] [bytes unit] [bytes cmd]
+// Percentages travel in hundredths (the precision shown), pids in ascending
+// order as deltas. Unchanged rows cost nothing.
+// Client -> agent: u8 'A', varint seq of the newest snapshot it has applied.
+// The agent codes against the newest acked snapshot still in its window of
+// WIRE_WINDOW, so frames lost to conflation or a slow ack only make deltas
+// larger, and sends a keyframe at least every WIRE_KEYFRAME_EVERY frames.
+static const size_t WIRE_WINDOW = 16;
+static const int WIRE_KEYFRAME_EVERY = 60;
+
+enum WireFlags : uint8_t { WIRE_NEW = 1, WIRE_CPU = 2, WIRE_MEM = 4, WIRE_RSS = 8, WIRE_USER = 16, WIRE_UNIT = 32, WIRE_CMD = 64 };
+
+// One process row of a streamed snapshot; percentages in hundredths.
+struct FleetRow {
+    pid_t pid = 0;
+    uint64_t starttime = 0;
+    uint32_t cpu = 0, mem = 0;
+    uint64_t rss_kb = 0;
+    string user, unit, cmd;
+    double cpu_percent() const { return cpu / 100.0; }
+    double mem_percent() const { return mem / 100.0; }
+};
+
+struct HostSnapshot {
+    uint64_t seq = 0;
+    string host;
+    uint64_t ts_ms = 0;
+    uint32_t cpu_usage = 0; // hundredths of a percent
+    uint64_t mem_total = 0, mem_used = 0, nprocs = 0;
+    vector<FleetRow> rows; // ascending pid
+};
+
+// Snapshot of the first top_k of the sorted rows (0 = all).
+void make_snapshot(HostSnapshot &s, uint64_t seq, const string &host, uint64_t ts_ms, const Sample &sample,
+                   const vector<const ProcSnapshot *> &rows, size_t top_k);
+
+// Appends one framed snapshot message, coded against base (nullptr = keyframe).
+void encode_frame(ByteWriter &w, const HostSnapshot &cur, const HostSnapshot *base);
+
+// Decodes a snapshot message into out. find_base returns the snapshot with
+// the given seq, or nullptr if the client no longer has it (base_missing is
+// then set and the frame cannot be applied).
+template <typename FindBase>
+bool decode_frame(string_view payload, FindBase find_base, HostSnapshot &out, bool &base_missing) {
+    ByteReader r(payload);
+    base_missing = false;
+    uint8_t tag = r.u8();
+    if (tag != 'K' && tag != 'D') return false;
+    out.seq = r.varint();
+    const HostSnapshot *base = nullptr;
+    if (tag == 'D') {
+        base = find_base(r.varint());
+        if (!base) {
+            base_missing = true;
+            return false;
+        }
+        out.host = base->host;
+        out.ts_ms = base->ts_ms + r.svarint();
+        out.cpu_usage = (uint32_t)r.varint();
+        out.mem_total = base->mem_total + r.svarint();
+        out.mem_used = base->mem_used + r.svarint();
+        out.nprocs = base->nprocs + r.svarint();
+    } else {
+        out.host = string(r.bytes());
+        out.ts_ms = r.varint();
+        out.cpu_usage = (uint32_t)r.varint();
+        out.mem_total = r.varint();
+        out.mem_used = r.varint();
+        out.nprocs = r.varint();
+    }
+
+    vector<pid_t> removed(min<size_t>(r.varint(), payload.size()));
+    pid_t pid = 0;
+    for (pid_t &p : removed) p = pid += (pid_t)r.svarint();
+    size_t nchanged = min<size_t>(r.varint(), payload.size());
+    if (!r.ok) return false;
+
+    // merge the base rows (minus removed ones) with the new and changed rows
+    static const vector<FleetRow> none;
+    const vector<FleetRow> &old = base ? base->rows : none;
+    out.rows.clear();
+    out.rows.reserve(old.size() + nchanged);
+    size_t i = 0, rm = 0;
+    pid = 0;
+    auto copy_until = [&](pid_t limit) {
+        for (; i < old.size() && old[i].pid < limit; ++i) {
+            while (rm < removed.size() && removed[rm] < old[i].pid) ++rm;
+            if (rm < removed.size() && removed[rm] == old[i].pid) continue;
+            out.rows.push_back(old[i]);
+        }
+    };
+    for (size_t n = 0; n < nchanged; ++n) {
+        pid += (pid_t)r.svarint();
+        uint8_t flags = r.u8();
+        copy_until(pid);
+        const FleetRow *o = i < old.size() && old[i].pid == pid ? &old[i++] : nullptr;
+        FleetRow row;
+        row.pid = pid;
+        if (flags & WIRE_NEW) {
+            row.starttime = r.varint();
+            row.cpu = (uint32_t)r.varint();
+            row.mem = (uint32_t)r.varint();
+            row.rss_kb = r.varint();
+            row.user = string(r.bytes());
+            row.unit = string(r.bytes());
+            row.cmd = string(r.bytes());
+        } else {
+            if (!o) return false;
+            row = *o;
+            if (flags & WIRE_CPU) row.cpu = (uint32_t)r.varint();
+            if (flags & WIRE_MEM) row.mem = (uint32_t)r.varint();
+            if (flags & WIRE_RSS) row.rss_kb += r.svarint();
+            if (flags & WIRE_USER) row.user = string(r.bytes());
+            if (flags & WIRE_UNIT) row.unit = string(r.bytes());
+            if (flags & WIRE_CMD) row.cmd = string(r.bytes());
+        }
+        if (!r.ok) return false;
+        out.rows.push_back(move(row));
+    }
+    copy_until(numeric_limits<pid_t>::max());
+    return r.ok;
+}
+
+// Appends a framed ack of snapshot seq (0 asks for a keyframe).
+void encode_ack(ByteWriter &w, uint64_t seq);
+
+#endif // SYSMON_CORE_H
@@ -0,0 +1,281 @@
+// sysmon_pipeline.cpp
+// Coroutine collection pipeline (see sysmon_pipeline.h).
+
+#include "sysmon_pipeline.h"
+#include <pthread.h>
+
+static mutex frames_mu;
+static map<size_t, vector<void *>> free_frames;
+
+void *frame_alloc(size_t n) {
+    {
+        lock_guard<mutex> lock(frames_mu);
+        auto &list = free_frames[n];
+        if (!list.empty()) {
+            void *p = list.back();
+            list.pop_back();
+            return p;
+        }
+    }
+    return ::operator new(n);
+}
+
+void frame_free(void *p, size_t n) {
+    lock_guard<mutex> lock(frames_mu);
+    free_frames[n].push_back(p);
+}
+
+vector<WorkerGroup> numa_worker_groups(const vector<NumaNode> &nodes, unsigned threads_per_node) {
+    vector<WorkerGroup> groups;
+    if (nodes.size() < 2) return groups;
+    // CPUs set aside for latency-sensitive work are left alone
+    set<int> reserved;
+    pmr::string buf;
+    for (const char *path : {"/sys/devices/system/cpu/isolated", "/sys/devices/system/cpu/nohz_full"})
+        if (read_file(path, buf))
+            for (int c : parse_cpu_list(buf)) reserved.insert(c);
+    for (const NumaNode &n : nodes) {
+        WorkerGroup g;
+        g.node = n.id;
+        for (int c : n.cpus)
+            if (!reserved.count(c)) g.cpus.push_back(c);
+        if (g.cpus.empty()) g.cpus = n.cpus; // all of them reserved: better than no group
+        if (g.cpus.empty()) continue;        // memory-only node
+        g.threads = threads_per_node ? threads_per_node : clamp((unsigned)g.cpus.size(), 1u, 4u);
+        groups.push_back(move(g));
+    }
+    if (groups.size() < 2) groups.clear();
+    return groups;
+}
+
+// Best effort: a listed CPU may be offline (or not exist, with a made-up topology).
+static void pin_to(const vector<int> &cpus) {
+    if (cpus.empty()) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+Executor::Executor(const vector<WorkerGroup> &groups) : queues(groups.size() + 1) {
+    for (unsigned g = 0; g < groups.size(); ++g) {
+        group_threads.push_back(max(groups[g].threads, 1u));
+        for (unsigned i = 0; i < group_threads[g]; ++i)
+            workers.emplace_back([this, g, cpus = groups[g].cpus] {
+                pin_to(cpus);
+                work(g);
+            });
+    }
+}
+
+Executor::~Executor() {
+    {
+        lock_guard<mutex> lock(mu);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+void Executor::post(coroutine_handle<> h, int group) {
+    {
+        lock_guard<mutex> lock(mu);
+        queues[group < 0 ? queues.size() - 1 : group].items.push_back(h);
+    }
+    // only the group's own workers may take it, and notify_one could wake another
+    if (group < 0 || groups() == 1) ready.notify_one();
+    else ready.notify_all();
+}
+
+void Executor::work(unsigned group) {
+    Queue &own = queues[group], &shared = queues.back();
+    unique_lock<mutex> lock(mu);
+    while (true) {
+        ready.wait(lock, [&] { return stopping || !own.empty() || !shared.empty(); });
+        Queue &q = own.empty() ? shared : own;
+        if (q.empty()) return; // stopping, and nothing left to run
+        coroutine_handle<> h = q.items[q.head++];
+        if (q.empty()) {
+            q.items.clear();
+            q.head = 0;
+        }
+        lock.unlock();
+        h.resume();
+        lock.lock();
+    }
+}
+
+void Sequencer::release(uint64_t ticket) {
+    coroutine_handle<> h;
+    {
+        lock_guard<mutex> lock(mu);
+        next = ticket + 1;
+        auto it = waiting.find(next);
+        if (it == waiting.end()) return;
+        h = it->second;
+        waiting.erase(it);
+    }
+    exec.post(h);
+}
+
+struct Pipeline::Job {
+    uint64_t ticket;
+    Sample &out;
+    pmr::memory_resource *mr;
+    function<void()> done;
+    pmr::vector<pid_t> pids;
+    unique_ptr<ReadBuffers> files; // group g's share of pids, from n * g / groups, is in files[g]
+    HostCounters host; // taken with the reads; the deltas are computed in order later
+    Timing timing;
+
+    Job(uint64_t ticket, Sample &out, pmr::memory_resource *mr, function<void()> done)
+        : ticket(ticket), out(out), mr(mr), done(move(done)), pids(mr) {}
+    static void *operator new(size_t n) { return frame_alloc(n); }
+    static void operator delete(void *p, size_t n) { frame_free(p, n); }
+};
+
+using pipeline_clock = chrono::steady_clock;
+
+static double ms_since(pipeline_clock::time_point t0) {
+    return chrono::duration<double, milli>(pipeline_clock::now() - t0).count();
+}
+
+Pipeline::Pipeline(unsigned threads)
+    : Pipeline(threads ? vector<WorkerGroup>{WorkerGroup{-1, {}, threads}} : vector<WorkerGroup>{}) {}
+
+Pipeline::Pipeline(const vector<WorkerGroup> &groups)
+    : exec(groups.empty() ? vector<WorkerGroup>{WorkerGroup{-1, {}, clamp(thread::hardware_concurrency(), 2u, 4u)}}
+                          : groups),
+      order(exec) {}
+
+void Pipeline::start(Sample &out, pmr::memory_resource *mr, function<void()> done) {
+    auto job = make_unique<Job>(++tickets, out, mr, move(done));
+    {
+        lock_guard<mutex> lock(mu);
+        ++in_flight;
+        if (!spare_files.empty()) {
+            job->files = move(spare_files.back());
+            spare_files.pop_back();
+        }
+    }
+    if (!job->files) job->files = make_unique<ReadBuffers>(exec.groups());
+    run_job(move(job));
+}
+
+void Pipeline::run(Sample &out, pmr::memory_resource *mr) {
+    start(out, mr);
+    drain();
+}
+
+void Pipeline::drain(int keep) {
+    unique_lock<mutex> lock(mu);
+    idle.wait(lock, [&] { return in_flight <= keep; });
+}
+
+Pipeline::Timing Pipeline::last_timing() const {
+    lock_guard<mutex> lock(mu);
+    return timing;
+}
+
+Detached Pipeline::run_job(unique_ptr<Job> job) {
+    co_await exec.schedule();
+    co_await enumerate(*job);
+    co_await read(*job);
+    co_await order.turn(job->ticket);
+    co_await parse_and_deltas(*job);
+    co_await publish(*job);
+    order.release(job->ticket);
+
+    function<void()> done = move(job->done);
+    Timing t = job->timing;
+    unique_ptr<ReadBuffers> files = move(job->files);
+    job.reset(); // frees the pid list into the tick's arena while the caller still waits
+    if (done) done();
+    lock_guard<mutex> lock(mu);
+    timing = t;
+    spare_files.push_back(move(files));
+    --in_flight;
+    idle.notify_all(); // under the lock: the pipeline may be destroyed right after
+}
+
+Task Pipeline::enumerate(Job &job) {
+    auto t0 = pipeline_clock::now();
+    if (collector.only_pid) job.pids.assign(1, collector.only_pid);
+    else job.pids = list_pids(job.mr);
+    job.timing.enumerate_ms = ms_since(t0);
+    co_return;
+}
+
+Task Pipeline::read(Job &job) {
+    auto t0 = pipeline_clock::now();
+    // reads may run during the previous tick's publish, so the host counters
+    // are taken here rather than when the ordered parse starts
+    job.host = read_host_counters(collector.fields, job.mr);
+    size_t n = job.pids.size();
+    unsigned groups = exec.groups();
+    WaitGroup wg;
+    for (unsigned g = 0; g < groups; ++g) {
+        size_t from = n * g / groups, to = n * (g + 1) / groups;
+        if (from == to) continue;
+        wg.add(1);
+        read_group(job, g, from, to, wg);
+    }
+    co_await wg.wait();
+    job.timing.read_ms = ms_since(t0);
+}
+
+// Reads pids[from, to) on the workers of one group, into that group's buffers.
+Detached Pipeline::read_group(Job &job, unsigned group, size_t from, size_t to, WaitGroup &wg) {
+    co_await exec.schedule(group);
+    vector<ProcFiles> &files = (*job.files)[group];
+    if (files.size() < to - from) files.resize(to - from); // first touched on the group's node
+    // a few batches per worker, so one slow process does not hold up a whole share
+    size_t batches = min(to - from, (size_t)exec.group_size(group) * 4);
+    size_t per = (to - from + batches - 1) / batches;
+    WaitGroup batches_done;
+    for (size_t b = from; b < to; b += per) {
+        batches_done.add(1);
+        read_batch(job, group, b, min(to, b + per), from, batches_done);
+    }
+    co_await batches_done.wait();
+    wg.done();
+}
+
+Detached Pipeline::read_batch(Job &job, unsigned group, size_t from, size_t to, size_t base, WaitGroup &wg) {
+    co_await exec.schedule(group);
+    vector<ProcFiles> &files = (*job.files)[group];
+    for (size_t i = from; i < to; ++i) read_proc_files(job.pids[i], files[i - base], collector.fields);
+    wg.done();
+}
+
+Task Pipeline::parse_and_deltas(Job &job) {
+    auto t0 = pipeline_clock::now();
+    ProcParser parse = proc_parser(collector.fields);
+    collector.begin(job.out, job.host);
+    size_t n = job.pids.size();
+    job.out.procs.reserve(n);
+    // merge the groups' shares back in PID list order
+    unsigned groups = (unsigned)job.files->size();
+    for (unsigned g = 0; g < groups; ++g) {
+        size_t from = n * g / groups, to = n * (g + 1) / groups;
+        const vector<ProcFiles> &files = (*job.files)[g];
+        for (size_t i = from; i < to; ++i) {
+            ProcSnapshot &cur = job.out.procs.emplace_back();
+            parse(job.pids[i], files[i - from], cur, *collector.pool);
+            collector.add(cur);
+        }
+    }
+    collector.end();
+    job.timing.parse_ms = ms_since(t0);
+    co_return;
+}
+
+Task Pipeline::publish(Job &job) {
+    auto t0 = pipeline_clock::now();
+    uint64_t ts = unix_ms();
+    if (ranker) ranker(job.out, ts);
+    for (auto &stage : stages) stage(job.out, ts);
+    job.timing.publish_ms = ms_since(t0);
+    co_return;
+}
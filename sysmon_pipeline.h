@@ -0,0 +1,268 @@
+// sysmon_pipeline.h
+// Collection as a pipeline of C++20 coroutine stages on a small executor:
+//
+//   enumerate -> read -> parse -> deltas -> rank -> publish
+//
+// enumerate lists /proc and read fans the per-process file reads out over the
+// worker threads; both are plain I/O and touch no shared state. parse and
+// deltas use the string pool and the process table, and rank and publish must
+// see the samples in order, so those run as one ordered section, one tick at
+// a time in tick order. A tick's reads therefore overlap the previous tick's
+// publishing (a slow recording disk does not delay the next scan).
+// Consumers such as the recorder plug in as publish stages, so adding one does
+// not touch the loop that drives the ticks.
+//
+// On a multi-socket host the workers can be split into one group per NUMA
+// node, pinned to that node's CPUs. Each group reads a contiguous share of the
+// PIDs into its own buffers, which its workers allocate and first touch, so
+// the pages stay on that node; parse walks the shares in order, which merges
+// them into the one sample.
+
+#ifndef SYSMON_PIPELINE_H
+#define SYSMON_PIPELINE_H
+
+#include "sysmon_core.h"
+#include <coroutine>
+
+// Threads of an Executor that share a queue: on a NUMA host, the workers of
+// one node, pinned to its housekeeping CPUs (empty cpus = not pinned).
+struct WorkerGroup {
+    int node = -1;
+    vector<int> cpus;
+    unsigned threads = 1;
+};
+
+// One group per node of a host with at least two nodes, each pinned to the
+// node's CPUs that are not isolated or nohz_full; threads_per_node 0 = one per
+// such CPU, 1 to 4. Empty for a single node (use the flat pool).
+vector<WorkerGroup> numa_worker_groups(const vector<NumaNode> &nodes, unsigned threads_per_node = 0);
+
+// Fixed pool of worker threads running coroutine continuations in FIFO order.
+// Work can be posted to the whole pool or to one group; a worker takes its
+// group's work first.
+class Executor {
+public:
+    explicit Executor(unsigned threads) : Executor(vector<WorkerGroup>{WorkerGroup{-1, {}, threads}}) {}
+    explicit Executor(const vector<WorkerGroup> &groups);
+    ~Executor(); // finishes the queued work, then joins
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    // group -1 = any worker
+    void post(coroutine_handle<> h, int group = -1);
+    unsigned size() const { return (unsigned)workers.size(); }
+    unsigned groups() const { return (unsigned)queues.size() - 1; }
+    unsigned group_size(unsigned group) const { return group_threads[group]; }
+
+    // co_await exec.schedule() continues the coroutine on a worker thread (of
+    // the given group).
+    auto schedule(int group = -1) {
+        struct Awaiter {
+            Executor &exec;
+            int group;
+            bool await_ready() { return false; }
+            void await_suspend(coroutine_handle<> h) { exec.post(h, group); }
+            void await_resume() {}
+        };
+        return Awaiter{*this, group};
+    }
+
+private:
+    struct Queue {
+        vector<coroutine_handle<>> items; // items[head..] pending; keeps its capacity
+        size_t head = 0;
+        bool empty() const { return head == items.size(); }
+    };
+
+    mutex mu;
+    condition_variable ready;
+    vector<Queue> queues; // one per group, then the shared one
+    vector<unsigned> group_threads;
+    bool stopping = false;
+    vector<thread> workers;
+
+    void work(unsigned group);
+};
+
+// Coroutine frames and per-tick state come from free lists kept per size, so
+// steady-state ticks do not go through the global heap.
+void *frame_alloc(size_t n);
+void frame_free(void *p, size_t n);
+
+// Lazily started coroutine without a result: co_await task starts it and
+// resumes the awaiter when it finishes (symmetric transfer, no queueing).
+class Task {
+public:
+    struct promise_type {
+        coroutine_handle<> continuation = noop_coroutine();
+
+        static void *operator new(size_t n) { return frame_alloc(n); }
+        static void operator delete(void *p, size_t n) { frame_free(p, n); }
+        Task get_return_object() { return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept { return false; }
+                coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept {
+                    return h.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+
+    Task(Task &&o) noexcept : h(exchange(o.h, {})) {}
+    Task(const Task &) = delete;
+    ~Task() { if (h) h.destroy(); }
+
+    bool await_ready() { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiter) {
+        h.promise().continuation = awaiter;
+        return h;
+    }
+    void await_resume() {}
+
+private:
+    coroutine_handle<promise_type> h;
+    explicit Task(coroutine_handle<promise_type> h) : h(h) {}
+};
+
+// Eagerly started coroutine that destroys itself when it finishes; for work
+// that reports completion through a WaitGroup or a callback.
+struct Detached {
+    struct promise_type {
+        static void *operator new(size_t n) { return frame_alloc(n); }
+        static void operator delete(void *p, size_t n) { frame_free(p, n); }
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// Joins a fan-out: add() per child, done() when a child finishes, and
+// co_await wait() resumes (on the thread of the last done()) once all have.
+// One wait() per use.
+class WaitGroup {
+public:
+    void add(int n) { count.fetch_add(n); }
+    void done() {
+        if (count.fetch_sub(1) == 1) waiter.resume();
+    }
+    auto wait() {
+        struct Awaiter {
+            WaitGroup &g;
+            bool await_ready() { return false; }
+            bool await_suspend(coroutine_handle<> h) {
+                g.waiter = h;
+                return g.count.fetch_sub(1) != 1; // drop the waiter's own count
+            }
+            void await_resume() {}
+        };
+        return Awaiter{*this};
+    }
+
+private:
+    atomic<int> count{1};
+    coroutine_handle<> waiter;
+};
+
+// Admits tickets 1, 2, 3, ... to a section one at a time, in ticket order.
+class Sequencer {
+public:
+    explicit Sequencer(Executor &exec) : exec(exec) {}
+
+    auto turn(uint64_t ticket) {
+        struct Awaiter {
+            Sequencer &s;
+            uint64_t ticket;
+            bool await_ready() { return false; }
+            bool await_suspend(coroutine_handle<> h) {
+                lock_guard<mutex> lock(s.mu);
+                if (ticket == s.next) return false;
+                s.waiting[ticket] = h;
+                return true;
+            }
+            void await_resume() {}
+        };
+        return Awaiter{*this, ticket};
+    }
+
+    // Ends ticket's turn and lets the next ticket in, if it is waiting.
+    void release(uint64_t ticket);
+
+private:
+    Executor &exec;
+    mutex mu;
+    uint64_t next = 1;
+    map<uint64_t, coroutine_handle<>> waiting;
+};
+
+class Pipeline {
+public:
+    // Called with each finished sample and its wall-clock time (Unix ms).
+    using Stage = function<void(Sample &sample, uint64_t ts_ms)>;
+
+    // Wall time of the stages of the last finished tick.
+    struct Timing {
+        double enumerate_ms = 0, read_ms = 0, parse_ms = 0, publish_ms = 0;
+    };
+
+    Collector collector; // used by the ordered stages; read it between ticks only
+
+    // 0 = one per CPU, 2 to 4: with two, a blocking publish stage leaves a
+    // worker for the next tick's reads
+    explicit Pipeline(unsigned threads = 0);
+    // Workers in the given groups (see numa_worker_groups); empty = Pipeline(0).
+    explicit Pipeline(const vector<WorkerGroup> &groups);
+    ~Pipeline() { drain(); }
+
+    // Orders the sample for consumers; runs before the publish stages.
+    void set_rank(Stage rank) { ranker = move(rank); }
+    // Publish stages run in the order they were added.
+    void add_stage(Stage stage) { stages.push_back(move(stage)); }
+
+    // Starts a tick filling out, with transient data in mr; done (if any) is
+    // called on a worker after the publish stages. out and mr must stay valid
+    // until then and not be shared with another tick in flight.
+    void start(Sample &out, pmr::memory_resource *mr, function<void()> done = nullptr);
+    // Runs one tick and waits for it.
+    void run(Sample &out, pmr::memory_resource *mr);
+    // Waits until at most keep ticks are in flight. Ticks publish in order, so
+    // drain(1) means all but the newest have finished with their samples.
+    void drain(int keep = 0);
+
+    Timing last_timing() const;
+    unsigned threads() const { return exec.size(); }
+    unsigned groups() const { return exec.groups(); }
+
+private:
+    struct Job; // per-tick state
+    using ReadBuffers = vector<vector<ProcFiles>>; // per worker group
+
+    Executor exec;
+    Sequencer order;
+    Stage ranker;
+    vector<Stage> stages;
+    uint64_t tickets = 0;
+
+    mutable mutex mu; // guards the members below
+    condition_variable idle;
+    int in_flight = 0;
+    Timing timing;
+    vector<unique_ptr<ReadBuffers>> spare_files; // reused across ticks; group g always fills [g]
+
+    Detached run_job(unique_ptr<Job> job);
+    Task enumerate(Job &job);
+    Task read(Job &job);
+    Detached read_group(Job &job, unsigned group, size_t from, size_t to, WaitGroup &wg);
+    Detached read_batch(Job &job, unsigned group, size_t from, size_t to, size_t base, WaitGroup &wg);
+    Task parse_and_deltas(Job &job);
+    Task publish(Job &job);
+};
+
+#endif // SYSMON_PIPELINE_H
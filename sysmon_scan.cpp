@@ -0,0 +1,223 @@
+// sysmon_scan.cpp
+// Numeric field scanner (see scan_fields in sysmon_core.h). The SIMD kernels
+// classify a block at a time: blanks, digits and the end of the line become
+// bitmasks, field starts (a non-blank byte after a blank) and their digit runs
+// come from the masks, and the digits are converted eight at a time with SWAR
+// arithmetic. The kernel is picked once at startup from what the CPU supports.
+
+#include "sysmon_core.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const uint64_t pow10_table[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+// Number of leading ASCII digits among the 8 bytes of chunk (first byte lowest).
+static inline int digit_run(uint64_t chunk) {
+    uint64_t x = chunk ^ 0x3030303030303030ULL; // digits become 0..9
+    // high bit set where x >= 10; a carry only reaches bytes after a non-digit
+    uint64_t nondigit = ((x + 0x7676767676767676ULL) | x) & 0x8080808080808080ULL;
+    return nondigit ? __builtin_ctzll(nondigit) / 8 : 8;
+}
+
+// Value of the first len (1..8) digits of chunk.
+static inline uint64_t digits_value(uint64_t chunk, int len) {
+    if (len < 8) chunk = (chunk << (64 - 8 * len)) | (0x3030303030303030ULL >> (8 * len)); // left-pad with '0'
+    chunk -= 0x3030303030303030ULL;
+    chunk = chunk * 10 + (chunk >> 8); // pairs of digits
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32), mul2 = 1 + (10000ULL << 32);
+    return (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+}
+
+// Decodes the field starting at s[p].
+static inline uint64_t decode_field(const char *s, size_t n, size_t p) {
+    bool neg = s[p] == '-';
+    p += neg;
+    uint64_t v = 0;
+    while (p + 8 <= n) {
+        uint64_t chunk;
+        memcpy(&chunk, s + p, 8);
+        int len = digit_run(chunk);
+        if (len) v = v * pow10_table[len] + digits_value(chunk, len);
+        if (len < 8) return neg ? 0 - v : v;
+        p += 8;
+    }
+    while (p < n && s[p] >= '0' && s[p] <= '9') v = v * 10 + (s[p++] - '0');
+    return neg ? 0 - v : v;
+}
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// Decodes the field starting at s[p] a byte at a time and leaves p at its end.
+static inline uint64_t decode_field_bytes(const char *s, size_t n, size_t &p) {
+    bool neg = s[p] == '-';
+    p += neg;
+    uint64_t v = 0;
+    while (p < n && s[p] >= '0' && s[p] <= '9') v = v * 10 + (s[p++] - '0');
+    while (p < n && !is_blank(s[p]) && s[p] != '\n') ++p;
+    return neg ? 0 - v : v;
+}
+
+static inline size_t field_end(const char *s, size_t n, size_t p) {
+    while (p < n && !is_blank(s[p]) && s[p] != '\n') ++p;
+    return p;
+}
+
+// Byte-at-a-time scan from s[i]; after_blank says whether a field may start there.
+static size_t scan_tail(const char *s, size_t n, size_t i, bool after_blank, uint64_t *out, size_t count,
+                        size_t max, size_t &consumed) {
+    if (!after_blank) i = field_end(s, n, i);
+    while (count < max) {
+        while (i < n && is_blank(s[i])) ++i;
+        if (i == n) break;
+        if (s[i] == '\n') {
+            consumed = i + 1;
+            return count;
+        }
+        out[count++] = decode_field_bytes(s, n, i);
+    }
+    consumed = i;
+    return count;
+}
+
+static size_t scan_scalar(const char *s, size_t n, uint64_t *out, size_t max, size_t &consumed) {
+    return scan_tail(s, n, 0, true, out, 0, max, consumed);
+}
+
+#if defined(__x86_64__)
+
+// Bitmasks of one block; bit i describes s[i].
+struct BlockMasks {
+    uint32_t blank, newline, digit;
+};
+
+struct Sse42Block {
+    static constexpr size_t W = 16;
+    __attribute__((target("sse4.2"))) static BlockMasks masks(const char *p) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        const __m128i blanks = _mm_setr_epi8(' ', '\t', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i digits = _mm_setr_epi8('0', '9', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        __m128i blank = _mm_cmpestrm(blanks, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        __m128i digit = _mm_cmpestrm(digits, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_BIT_MASK);
+        uint32_t nl = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        return {(uint32_t)_mm_cvtsi128_si32(blank), nl, (uint32_t)_mm_cvtsi128_si32(digit)};
+    }
+};
+
+struct Avx2Block {
+    static constexpr size_t W = 32;
+    __attribute__((target("avx2"))) static BlockMasks masks(const char *p) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+        // '0' <= c <= '9' as signed compares; bytes >= 0x80 are negative, so not digits
+        __m256i digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('9')),
+                                            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)));
+        return {(uint32_t)_mm256_movemask_epi8(blank),
+                (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                (uint32_t)_mm256_movemask_epi8(digit)};
+    }
+};
+
+template <class Block>
+static inline size_t scan_blocks(const char *s, size_t n, uint64_t *out, size_t max, size_t &consumed) {
+    const uint32_t full = Block::W == 32 ? ~0u : (1u << Block::W) - 1;
+    size_t i = 0, count = 0;
+    uint32_t after_blank = 1; // a field may start at s[0]
+    // + 8: decode_field may read a whole SWAR word past the block
+    while (count < max && i + Block::W + 8 <= n) {
+        BlockMasks m = Block::masks(s + i);
+        uint32_t in_line = m.newline ? (m.newline & (0 - m.newline)) - 1 : full; // bytes before the newline
+        uint32_t starts = ~m.blank & ((m.blank << 1) | after_blank) & in_line;
+        while (starts) {
+            int b = __builtin_ctz(starts);
+            size_t p = i + b;
+            // digit run from the mask when it ends inside the block and fits one word
+            int len = __builtin_ctzll(~(uint64_t)(m.digit >> b)); // bits above the block are 0
+            if (b + len < (int)Block::W && len <= 8 && s[p] != '-') {
+                uint64_t chunk;
+                memcpy(&chunk, s + p, 8);
+                out[count++] = len ? digits_value(chunk, len) : 0;
+            } else {
+                out[count++] = decode_field(s, n, p);
+            }
+            if (count == max) {
+                consumed = field_end(s, n, p);
+                return count;
+            }
+            starts &= starts - 1;
+        }
+        if (m.newline) {
+            consumed = i + __builtin_ctz(m.newline) + 1;
+            return count;
+        }
+        after_blank = (m.blank >> (Block::W - 1)) & 1;
+        i += Block::W;
+    }
+    return scan_tail(s, n, i, after_blank, out, count, max, consumed);
+}
+
+__attribute__((target("sse4.2"), flatten)) static size_t scan_sse42(const char *s, size_t n, uint64_t *out,
+                                                                    size_t max, size_t &consumed) {
+    return scan_blocks<Sse42Block>(s, n, out, max, consumed);
+}
+
+__attribute__((target("avx2"), flatten)) static size_t scan_avx2(const char *s, size_t n, uint64_t *out,
+                                                                 size_t max, size_t &consumed) {
+    return scan_blocks<Avx2Block>(s, n, out, max, consumed);
+}
+
+#endif
+
+using ScanFn = size_t (*)(const char *, size_t, uint64_t *, size_t, size_t &);
+
+static bool isa_supported(ScanIsa isa) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (isa == ScanIsa::Avx2) return __builtin_cpu_supports("avx2");
+    if (isa == ScanIsa::Sse42) return __builtin_cpu_supports("sse4.2");
+#endif
+    return isa == ScanIsa::Scalar;
+}
+
+static ScanFn scan_fn_for(ScanIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ScanIsa::Avx2) return scan_avx2;
+    if (isa == ScanIsa::Sse42) return scan_sse42;
+#endif
+    return scan_scalar;
+}
+
+static ScanIsa best_isa() {
+    for (ScanIsa isa : {ScanIsa::Avx2, ScanIsa::Sse42})
+        if (isa_supported(isa)) return isa;
+    return ScanIsa::Scalar;
+}
+
+static ScanIsa active_isa = best_isa();
+static ScanFn active_scan = scan_fn_for(active_isa);
+
+size_t scan_fields(string_view s, uint64_t *out, size_t max, size_t *consumed) {
+    size_t used = 0;
+    size_t n = active_scan(s.data(), s.size(), out, max, used);
+    if (consumed) *consumed = used;
+    return n;
+}
+
+ScanIsa scan_isa() { return active_isa; }
+
+bool set_scan_isa(ScanIsa isa) {
+    if (!isa_supported(isa)) return false;
+    active_isa = isa;
+    active_scan = scan_fn_for(isa);
+    return true;
+}
+
+const char *scan_isa_name(ScanIsa isa) {
+    switch (isa) {
+    case ScanIsa::Avx2: return "avx2";
+    case ScanIsa::Sse42: return "sse4.2";
+    default: return "scalar";
+    }
+}
@@ -1,14 +1,66 @@
-// sysmon.cpp
+// system_monitor.cpp
 // System Monitor Tool (simple top-like tool) for Linux
-// Compile: g++ sysmon.cpp -o sysmon -std=c++17 -lncurses
+// Build: make -f MakeFile (sysmon, plus libsysmon.a/.so from sysmon_core.cpp + libsysmon.cpp)
 //
 // Features:
 // - Shows CPU usage, memory usage
-// - Lists processes with PID, USER, %CPU, %MEM, RSS, CMD
-// - Sort by CPU or MEM (toggle with 's')
+// - Lists processes with PID, USER, %CPU, %MEM, RSS, UNIT, CMD
+//   (UNIT = container ID or systemd unit, from /proc/<pid>/cgroup)
+// - Sort by CPU, MEM or I/O wait (cycle with 's'; I/O wait only with delay accounting)
 // - Kill a process by PID (press 'k' then enter PID)
+// - Show only the processes of one container/unit (press 'c' then enter it)
 // - Refresh automatically every REFRESH_INTERVAL seconds (default 2s)
 // - Quit with 'q'
+//
+// - Scroll with Up/Down/PgUp/PgDn/Home; sort, filter, scroll and resize only
+//   redraw the current sample, /proc is rescanned on the refresh timer or 'r'
+// - Collection is a coroutine pipeline (sysmon_pipeline.h) on a few worker
+//   threads; recording and rollups are its publish stages
+// - Diff view ('d'): processes appeared/gone, CPU time, I/O and RSS change and
+//   unit/user totals since a marked sample ('m') or an earlier one ('<', '>')
+// - NUMA view ('n'): per-node memory and numastat hit/miss/foreign rates, and
+//   the node placement of the top processes' pages and threads from
+//   numa_maps (read lazily), flagging memory that is remote to the threads
+// - Huge page view ('h'): THP settings and usage, THP fault/collapse/split and
+//   compaction stall rates, free blocks by size per zone (fragmentation)
+// - OOM column: /proc/<pid>/oom_score of the rows on screen; OOM kills are
+//   detected from /proc/vmstat, cgroup memory.events and /dev/kmsg and logged
+//   with the victim's last sample ('o')
+//
+// Options:
+//   --ansi   draw with raw ANSI escapes (changed spans only, one write(2) per
+//            frame) instead of ncurses; for tmux panes, serial consoles, slow SSH
+//   --fps N  redraw at most N times per second (default 30)
+//   --numa-workers  one group of collection workers per NUMA node, pinned to
+//            the node's housekeeping CPUs, reading into node-local buffers
+//
+// Batch mode (no ncurses): take two samples --interval ms apart, print the
+// sorted table and exit.
+//   --once | --batch      [--interval MS] [--format text|csv|json] [-n N]
+//                         [--sort cpu|mem|io] [--unit UNIT]
+//
+// History:
+//   --record FILE                          append every TUI sample to FILE
+//   --rollup FILE                          keep min/max/avg rollups in FILE
+//                                          (1 s for 1 h, 10 s for 1 d, 1 min for 30 d)
+//   sysmon record FILE|- [--interval MS] [--count N] [--rollup FILE]
+//                                          record without a UI ("-": rollups only)
+//   sysmon rollup FILE [--from MS] [--to MS] [--points N] [--format text|csv]
+//                                          read a range from the best-fitting tier
+//   sysmon export-columnar IN OUT [--chunk-rows N]   recording -> columnar file
+//   sysmon dump-columnar FILE [col,col,...]          columnar file -> CSV
+//   sysmon query FILE top-cpu|peak-rss|dstate PID [--from MS] [--to MS] [-k N] [--threads N]
+//                    questions over a columnar file; chunks are scanned in
+//                    parallel and skipped using the footer's min/max index
+//   sysmon diff FILE.smr [FROM_MS [TO_MS]] [-n N]    what changed between two samples
+//
+// Fleet:
+//   sysmon agent --listen host:port|unix:/path [--interval MS] [--top K] [--name NAME]
+//                    headless; pushes each sample's top-K processes to clients
+//   --connect ADDR   (repeatable) fleet view over agents instead of the local
+//                    host: a summary row per host and the merged top processes
+//
+// Benchmarks: sysmon bench [<name> [iterations]]   (without a name, runs them all)
 
 #include <bits/stdc++.h>
 #include <ncurses.h>
@@ -18,318 +70,4009 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <memory_resource>
+#include "sysmon_core.h"
+#include "sysmon_pipeline.h"
 
 using namespace std;
 
-struct CpuSnapshot {
-    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice;
-    unsigned long long total() const {
-        return user + nice + system + idle + iowait + irq + softirq + steal + guest + guest_nice;
-    }
-    unsigned long long idleAll() const {
-        return idle + iowait;
-    }
-};
-
-struct ProcSnapshot {
-    pid_t pid;
-    string user;
-    string cmd;
-    unsigned long long utime;
-    unsigned long long stime;
-    unsigned long long total_time() const { return utime + stime; }
-    unsigned long rss; // in KB (approx)
-    double cpu_percent;
-    double mem_percent;
-};
-
-static const int REFRESH_INTERVAL = 2; // seconds
-static long Hertz = sysconf(_SC_CLK_TCK);
-static unsigned long long total_mem_kb_cache = 0;
-
-bool sort_by_cpu = true;
-
-CpuSnapshot read_cpu_line() {
-    CpuSnapshot s = {0};
-    ifstream f("/proc/stat");
-    string line;
-    if (!f.is_open()) return s;
-    getline(f, line);
-    // Example: cpu  4705 150 1994 136239 234 0 45 0 0 0
-    string label;
-    stringstream ss(line);
-    ss >> label;
-    ss >> s.user >> s.nice >> s.system >> s.idle >> s.iowait >> s.irq >> s.softirq >> s.steal >> s.guest >> s.guest_nice;
-    return s;
-}
-
-unsigned long long read_total_memory_kb() {
-    ifstream f("/proc/meminfo");
-    string line;
-    unsigned long long memTotal = 0;
-    while (getline(f, line)) {
-        if (line.rfind("MemTotal:", 0) == 0) {
-            stringstream ss(line);
-            string label; unsigned long long val; string unit;
-            ss >> label >> val >> unit;
-            memTotal = val; // kB
-            break;
+// Counts every global operator new, so the instrumentation can show how many
+// heap allocations a tick performs (steady-state collection should do none).
+static atomic<unsigned long long> g_heap_allocs{0};
+
+__attribute__((noinline)) void *operator new(size_t n) {
+    g_heap_allocs.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Table order; IoWait is offered only while delay accounting is on.
+enum class SortKey { Cpu, Mem, IoWait };
+SortKey sort_key = SortKey::Cpu;
+string unit_filter; // empty = show all processes
+
+// ProcFields behind the table columns (USER, %MEM, RSS, IOW%, CMD); the TUI
+// reads PF_ALL because history and rollups also use state and I/O.
+static const unsigned TABLE_FIELDS = PF_CMD | PF_USER | PF_RSS | PF_BLKIO;
+
+// Per-tick instrumentation shown at the bottom of the screen.
+struct TickStats {
+    double collect_ms = 0.0;
+    double read_ms = 0.0; // of which /proc reads, spread over the pipeline's workers
+    unsigned threads = 0;
+    unsigned long long heap_allocs = 0; // global operator new calls during collection
+    size_t arena_used = 0, arena_capacity = 0;
+    unsigned long long samples = 0, frames = 0; // /proc scans and redraws so far
+};
+
+// Formats process table rows into fixed-width buffers without printf: numbers
+// go through std::to_chars, and each row is cached per PID so only the cells
+// whose value changed since the last frame are reformatted.
+//
+// PID     USER       %CPU   %MEM   RSS(kB)   OOM  IOW%   UNIT                     CMD
+// <7>     <10>       <6.2> <7.2>  <10>      <4>  <6.2>  <24>                     <40>
+class RowFormatter {
+public:
+    static constexpr int PID_AT = 0, PID_W = 7;
+    static constexpr int USER_AT = 8, USER_W = 10;
+    static constexpr int CPU_AT = 19, CPU_W = 6;
+    static constexpr int MEM_AT = 26, MEM_W = 7;
+    static constexpr int RSS_AT = 34, RSS_W = 10;
+    static constexpr int OOM_AT = 45, OOM_W = 4;
+    static constexpr int IOW_AT = 51, IOW_W = 6;
+    static constexpr int UNIT_AT = 58, UNIT_W = 24;
+    static constexpr int CMD_AT = 83, CMD_W = 40;
+    static constexpr int ROW_W = CMD_AT + CMD_W;
+
+    size_t cells_formatted = 0; // since the last reset_stats()
+
+    // The formatted row for p with its oom_score (-1 = unknown); valid until
+    // the next call for the same PID.
+    string_view format(const ProcSnapshot &p, int oom_score) {
+        auto &slot = rows.slot(p.pid);
+        Row &r = slot.value;
+        bool fresh = slot.stamp == 0 || r.starttime != p.starttime;
+        if (fresh) {
+            memset(r.text, ' ', ROW_W);
+            slot.stamp = 1;
+            r.starttime = p.starttime;
+            put_int(r.text + PID_AT, PID_W, p.pid, false);
+        }
+        if (fresh || r.user != p.user) put_str(r.text + USER_AT, USER_W, r.user = p.user);
+        if (fresh || r.cpu != p.cpu_percent) put_fixed2(r.text + CPU_AT, CPU_W, r.cpu = p.cpu_percent);
+        if (fresh || r.mem != p.mem_percent) put_fixed2(r.text + MEM_AT, MEM_W, r.mem = p.mem_percent);
+        if (fresh || r.rss != p.rss) put_int(r.text + RSS_AT, RSS_W, r.rss = p.rss, true);
+        if (fresh || r.oom != oom_score) {
+            if ((r.oom = oom_score) >= 0) put_int(r.text + OOM_AT, OOM_W, oom_score, true);
+            else put_cell(r.text + OOM_AT, OOM_W, unknown, unknown + 1, true);
+        }
+        if (fresh || r.iow != p.io_wait_percent) put_fixed2(r.text + IOW_AT, IOW_W, r.iow = p.io_wait_percent);
+        if (fresh || r.unit != p.unit) put_str(r.text + UNIT_AT, UNIT_W, r.unit = p.unit);
+        if (fresh || r.cmd != p.cmd) {
+            r.cmd = p.cmd;
+            string_view cmd = strings.str(p.cmd).substr(0, CMD_W);
+            memcpy(r.text + CMD_AT, cmd.data(), cmd.size());
+            r.len = CMD_AT + cmd.size();
+            ++cells_formatted;
+        }
+        return string_view(r.text, r.len);
+    }
+
+    void reset_stats() { cells_formatted = 0; }
+
+    // A row without its IOW% cell, for when delay accounting is off: the part
+    // before the cell and the part after it.
+    static pair<string_view, string_view> split_io_wait(string_view row) {
+        return {row.substr(0, IOW_AT), row.substr(UNIT_AT)};
+    }
+
+private:
+    struct Row {
+        unsigned long long starttime = 0;
+        StrId user = 0, unit = 0, cmd = 0;
+        double cpu = 0.0, mem = 0.0, iow = 0.0;
+        unsigned long long rss = 0;
+        int oom = -1;
+        size_t len = 0;
+        char text[ROW_W];
+    };
+    PidTable<Row> rows;
+    static constexpr const char *unknown = "-";
+
+    // Writes the characters [b, e) into a width-w cell, right- or left-aligned.
+    void put_cell(char *cell, int w, const char *b, const char *e, bool right) {
+        int n = min<int>(e - b, w);
+        memset(cell, ' ', w);
+        memcpy(right ? cell + w - n : cell, b, n);
+        ++cells_formatted;
+    }
+    void put_int(char *cell, int w, unsigned long long v, bool right) {
+        char tmp[24];
+        auto res = to_chars(tmp, tmp + sizeof tmp, v);
+        put_cell(cell, w, tmp, res.ptr, right);
+    }
+    // Two decimals, fewer if the value would not fit (IOW% and %CPU are summed
+    // over threads, so they can pass 100), and ">999..." if even the integer
+    // part does not: put_cell would cut the digits off without a trace.
+    void put_fixed2(char *cell, int w, double v) {
+        char tmp[32];
+        for (int decimals = 2; decimals >= 0; --decimals) {
+            auto res = to_chars(tmp, tmp + sizeof tmp, v, chars_format::fixed, decimals);
+            if (res.ec == errc() && res.ptr - tmp <= w) {
+                put_cell(cell, w, tmp, res.ptr, true);
+                return;
+            }
+        }
+        tmp[0] = '>';
+        memset(tmp + 1, '9', w - 1);
+        put_cell(cell, w, tmp, tmp + w, true);
+    }
+    void put_str(char *cell, int w, StrId id) {
+        string_view text = strings.str(id);
+        put_cell(cell, w, text.data(), text.data() + text.size(), false);
+    }
+};
+
+// Screen output as seen by the drawing code. draw_frame() holds the layout and
+// only talks to this interface, so the ncurses and raw ANSI backends share it.
+class Renderer {
+public:
+    virtual ~Renderer() {}
+    virtual int rows() const = 0;
+    virtual int cols() const = 0;
+    virtual void begin_frame() = 0;
+    virtual void put(int y, int x, string_view text, bool bold = false) = 0;
+    virtual void end_frame() = 0;
+    // Next key, waiting up to timeout_ms (-1 = forever); ERR if none.
+    virtual int get_key(int timeout_ms) = 0;
+    // Reads a line typed by the user after question, shown on the prompt row.
+    virtual void prompt(const char *question, char *buf, int n) = 0;
+    // Shows text on the prompt row over the frame on screen, which stays as it is.
+    virtual void notice(const char *text) = 0;
+
+    size_t frame_bytes = 0; // bytes written to the terminal by the last end_frame()
+
+    void putf(int y, int x, bool bold, const char *fmt, ...) __attribute__((format(printf, 5, 6))) {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof buf, fmt, ap);
+        va_end(ap);
+        put(y, x, string_view(buf, min<int>(max(n, 0), sizeof buf - 1)), bold);
+    }
+};
+
+// Bytes this process has passed to write(2) so far ("wchar" in /proc/self/io);
+// ncurses does its own output buffering, so this is how its frames are measured.
+static unsigned long long written_bytes() {
+    char buf[512];
+    pmr::monotonic_buffer_resource mr(buf, sizeof buf);
+    pmr::string io(&mr);
+    if (!read_file("/proc/self/io", io)) return 0;
+    return meminfo_value(io, "wchar:");
+}
+
+class NcursesRenderer : public Renderer {
+public:
+    NcursesRenderer() {
+        initscr();
+        cbreak();
+        noecho();
+        keypad(stdscr, TRUE);
+        curs_set(0);
+    }
+    ~NcursesRenderer() override { endwin(); }
+
+    int rows() const override { return LINES; }
+    int cols() const override { return COLS; }
+    void begin_frame() override { erase(); }
+    void put(int y, int x, string_view text, bool bold) override {
+        if (bold) attron(A_BOLD);
+        mvaddnstr(y, x, text.data(), min<int>(text.size(), max(COLS - x, 0)));
+        if (bold) attroff(A_BOLD);
+    }
+    void end_frame() override {
+        unsigned long long before = written_bytes();
+        refresh();
+        frame_bytes = written_bytes() - before;
+    }
+    int get_key(int timeout_ms) override {
+        timeout(timeout_ms);
+        return getch();
+    }
+    void prompt(const char *question, char *buf, int n) override {
+        echo();
+        curs_set(1);
+        mvprintw(LINES - 2, 0, "%s", question);
+        clrtoeol();
+        timeout(-1);
+        getnstr(buf, n - 1);
+        noecho();
+        curs_set(0);
+    }
+    void notice(const char *text) override {
+        mvprintw(LINES - 2, 0, "%s", text);
+        clrtoeol();
+        refresh();
+    }
+};
+
+// Writes frames as a minimal ANSI escape stream: the new frame is drawn into a
+// back buffer, compared row by row with the previous one, and only the changed
+// span of each row is sent (cursor move + text), all in a single write(2).
+class AnsiRenderer : public Renderer {
+public:
+    AnsiRenderer() {
+        tcgetattr(STDIN_FILENO, &saved);
+        termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        // no SA_RESTART: a resize interrupts poll() in get_key()
+        struct sigaction sa = {};
+        sa.sa_handler = [](int) { resized = 1; };
+        sigaction(SIGWINCH, &sa, nullptr);
+        emit("\x1b[?1049h\x1b[?25l");
+    }
+    ~AnsiRenderer() override {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        emit("\x1b[0m\x1b[?25h\x1b[?1049l");
+    }
+
+    int rows() const override { return height; }
+    int cols() const override { return width; }
+
+    void begin_frame() override {
+        struct winsize ws;
+        int h = 24, w = 80;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0) {
+            h = ws.ws_row;
+            w = ws.ws_col;
+        }
+        if (h != height || w != width) {
+            // resized: forget the previous frame so everything is redrawn
+            height = h;
+            width = w;
+            prev_text.assign(height, string(width, ' '));
+            prev_bold.assign(height, string(width, 0));
+            out += "\x1b[2J";
+        }
+        text.assign(height, string(width, ' '));
+        bold_.assign(height, string(width, 0));
+    }
+
+    void put(int y, int x, string_view s, bool bold) override {
+        if (y < 0 || y >= height || x >= width) return;
+        size_t n = min(s.size(), (size_t)(width - x));
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = s[i];
+            text[y][x + i] = c < 0x20 || c == 0x7f ? ' ' : c;
+            bold_[y][x + i] = bold;
+        }
+    }
+
+    void end_frame() override {
+        bool in_bold = false;
+        for (int y = 0; y < height; ++y) {
+            int first = 0, last = width - 1;
+            while (first < width && text[y][first] == prev_text[y][first] && bold_[y][first] == prev_bold[y][first]) ++first;
+            if (first == width) continue;
+            while (text[y][last] == prev_text[y][last] && bold_[y][last] == prev_bold[y][last]) --last;
+            char move[32];
+            out.append(move, snprintf(move, sizeof move, "\x1b[%d;%dH", y + 1, first + 1));
+            for (int x = first; x <= last; ++x) {
+                if (bold_[y][x] != in_bold) {
+                    in_bold = bold_[y][x];
+                    out += in_bold ? "\x1b[1m" : "\x1b[22m";
+                }
+                out += text[y][x];
+            }
+        }
+        if (in_bold) out += "\x1b[22m";
+        frame_bytes = out.size();
+        emit(out);
+        out.clear();
+        swap(text, prev_text);
+        swap(bold_, prev_bold);
+    }
+
+    int get_key(int timeout_ms) override {
+        if (!pending.empty()) {
+            unsigned char c = pending.front();
+            pending.pop_front();
+            return c;
+        }
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (resized) {
+            resized = 0;
+            return KEY_RESIZE;
+        }
+        if (ready <= 0) return ERR;
+        unsigned char c;
+        if (read(STDIN_FILENO, &c, 1) != 1) return ERR;
+        if (c != 0x1b) return c;
+        // escape sequences for the keys the UI uses: arrows, Home, PgUp/PgDn
+        // ("\x1b[5~"); bytes that turn out not to be part of one, as after a
+        // lone ESC or with Alt, are kept for the next calls
+        unsigned char seq[3];
+        if (!next_byte(seq[0])) return 0x1b;
+        if (seq[0] != '[') {
+            pending.push_back(seq[0]);
+            return 0x1b;
+        }
+        if (!next_byte(seq[1])) {
+            pending.push_back('[');
+            return 0x1b;
+        }
+        switch (seq[1]) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'H': return KEY_HOME;
+        case '5':
+        case '6':
+            if (!next_byte(seq[2])) return ERR;
+            if (seq[2] == '~') return seq[1] == '5' ? KEY_PPAGE : KEY_NPAGE;
+            pending.push_back(seq[2]);
+            return ERR;
+        }
+        return ERR; // a sequence the UI does not use
+    }
+
+    void prompt(const char *question, char *buf, int n) override {
+        char head[64];
+        string line(head, snprintf(head, sizeof head, "\x1b[%d;1H\x1b[2K\x1b[?25h", height - 1));
+        line += question;
+        emit(line);
+        int len = 0;
+        while (true) {
+            int c = get_key(-1);
+            if (c == '\n' || c == '\r' || c == ERR) break;
+            if ((c == 0x7f || c == '\b') && len > 0) {
+                --len;
+                emit("\b \b");
+            } else if (c >= 0x20 && c < 0x7f && len < n - 1) {
+                buf[len++] = (char)c;
+                char ch = (char)c;
+                emit(string_view(&ch, 1));
+            }
+        }
+        buf[len] = '\0';
+        emit("\x1b[?25l");
+        // the prompt row no longer matches what prev_text says is on screen
+        if (height >= 2) prev_text[height - 2].assign(width, '\x01');
+    }
+
+    void notice(const char *text) override {
+        char head[64];
+        string line(head, snprintf(head, sizeof head, "\x1b[%d;1H\x1b[2K", height - 1));
+        line += text;
+        emit(line);
+        if (height >= 2) prev_text[height - 2].assign(width, '\x01');
+    }
+
+private:
+    static volatile sig_atomic_t resized;
+    termios saved;
+    int height = 0, width = 0;
+    vector<string> text, bold_, prev_text, prev_bold;
+    string out;
+    deque<unsigned char> pending; // read while looking for an escape sequence, not yet returned
+
+    // Next input byte if one arrives within 20 ms (the rest of an escape sequence).
+    static bool next_byte(unsigned char &c) {
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        return poll(&pfd, 1, 20) > 0 && read(STDIN_FILENO, &c, 1) == 1;
+    }
+
+    static void emit(string_view s) {
+        while (!s.empty()) {
+            ssize_t n = write(STDOUT_FILENO, s.data(), s.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            s.remove_prefix(n);
+        }
+    }
+};
+
+volatile sig_atomic_t AnsiRenderer::resized = 0;
+
+// What the process table shows of the current sample: the filtered, sorted rows
+// and the scroll position. Rebuilt from the sample without touching /proc.
+struct View {
+    vector<const ProcSnapshot *> rows;
+    size_t scroll = 0; // index of the first visible row
+
+    void rebuild(const Sample &sample, const CgroupCache &cgroups) {
+        rows.clear();
+        // keep only the members of the selected container/unit
+        const unordered_set<pid_t> *members = nullptr;
+        if (!unit_filter.empty()) members = cgroups.members(strings.find(unit_filter));
+        for (const ProcSnapshot &p : sample.procs)
+            if (unit_filter.empty() || (members && members->count(p.pid))) rows.push_back(&p);
+        sort_rows();
+    }
+
+    void sort_rows() {
+        if (sort_key == SortKey::Cpu) {
+            sort(rows.begin(), rows.end(), [](const ProcSnapshot *a, const ProcSnapshot *b){
+                if (a->cpu_percent == b->cpu_percent) return a->mem_percent > b->mem_percent;
+                return a->cpu_percent > b->cpu_percent;
+            });
+        } else if (sort_key == SortKey::IoWait) {
+            sort(rows.begin(), rows.end(), [](const ProcSnapshot *a, const ProcSnapshot *b){
+                if (a->io_wait_percent == b->io_wait_percent) return a->cpu_percent > b->cpu_percent;
+                return a->io_wait_percent > b->io_wait_percent;
+            });
+        } else {
+            sort(rows.begin(), rows.end(), [](const ProcSnapshot *a, const ProcSnapshot *b){
+                if (a->mem_percent == b->mem_percent) return a->cpu_percent > b->cpu_percent;
+                return a->mem_percent > b->mem_percent;
+            });
         }
     }
-    return memTotal;
+
+    // Moves the first visible row by delta, keeping a page of rows on screen.
+    void scroll_by(long delta, int page) {
+        long last = max<long>((long)rows.size() - page, 0);
+        scroll = (size_t)min(max<long>((long)scroll + delta, 0), last);
+    }
+};
+
+// "Reclaim/s: ..." for the memory line; empty until there are two samples.
+// Direct scans and allocation stalls mean tasks are reclaiming memory
+// themselves, in the middle of their allocations.
+int format_reclaim(char *buf, size_t n, const ReclaimRates &r) {
+    if (!r.valid) return snprintf(buf, n, "%s", "");
+    return snprintf(buf, n, "Reclaim/s: scan %.0f kswapd + %.0f direct  steal %.0f  allocstall %.0f  refault %.0f",
+                    r.pgscan_kswapd, r.pgscan_direct, r.pgsteal, r.allocstall, r.workingset_refault);
 }
 
-string uid_to_user(uid_t uid) {
-    struct passwd *pw = getpwuid(uid);
-    if (pw) return string(pw->pw_name);
-    return to_string(uid);
+// oom_score of the rows on screen. There is one file per process, so a score
+// is read only when its row is drawn, at most once per sample.
+class OomScores {
+public:
+    // sample: number of the current sample, from 1
+    int get(const ProcSnapshot &p, unsigned long long sample) {
+        auto &slot = scores.slot(p.pid);
+        if (slot.stamp != sample || slot.value.starttime != p.starttime) {
+            slot.stamp = sample;
+            slot.value.starttime = p.starttime;
+            slot.value.score = read_oom_score(p.pid);
+        }
+        return slot.value.score;
+    }
+
+private:
+    struct Entry {
+        unsigned long long starttime = 0;
+        int score = -1;
+    };
+    PidTable<Entry> scores;
+};
+
+// Table header, with and without the IOW% column.
+static const char *TABLE_HEADER = "PID     USER       %CPU   %MEM   RSS(kB)   OOM  IOW%   UNIT                     CMD";
+static const char *TABLE_HEADER_NO_IOW = "PID     USER       %CPU   %MEM   RSS(kB)   OOM  UNIT                     CMD";
+
+static const char *sort_name(SortKey k) {
+    return k == SortKey::Cpu ? "CPU" : k == SortKey::Mem ? "MEM" : "I/O WAIT";
 }
 
-bool is_number(const string &s) {
-    for (char c : s) if (!isdigit(c)) return false;
-    return true;
+// Screens of the TUI: the process table, or a report that replaces it.
+enum class Screen { Table, Diff, Numa, HugePages, OomKills };
+
+// Layout of one screen. oom_status: summary of the OOM kill log, "" if empty.
+void draw_frame(Renderer &r, const Sample &sample, View &view, const TickStats &stats,
+                RowFormatter &formatter, OomScores &oom_scores, const string &oom_status) {
+    r.begin_frame();
+    int lines = r.rows();
+    const auto &procs = view.rows;
+    // title segments one after another, each as wide as its text
+    char title[128], rows_text[80];
+    int x0 = snprintf(title, sizeof title, "SysMon - simple system monitor (press q to quit)   Refresh: %ds   Sort: %s   ",
+                      REFRESH_INTERVAL, sort_name(sort_key));
+    r.put(0, 0, title, true);
+    int max_rows = lines - 6;
+    view.scroll_by(0, max_rows); // re-clamp after resize or a shorter sample
+    if (procs.size() > (size_t)max_rows) {
+        int n = snprintf(rows_text, sizeof rows_text, "Rows %zu-%zu of %zu   ", view.scroll + 1,
+                         min(procs.size(), view.scroll + max_rows), procs.size());
+        r.put(0, x0, rows_text);
+        x0 += n;
+    }
+    if (!oom_status.empty()) r.put(0, x0, oom_status, true);
+    char mem[128], reclaim[160];
+    int x = snprintf(mem, sizeof mem, "CPU Usage: %.2f%%   Mem: %llu kB total   Used: %llu kB (approx)   ",
+                     sample.cpu_usage, sample.mem_total, sample.mem_used);
+    r.put(1, 0, mem);
+    // bold while tasks are stuck in direct reclaim
+    const ReclaimRates &rr = sample.reclaim;
+    int len = format_reclaim(reclaim, sizeof reclaim, rr);
+    r.put(1, x, reclaim, rr.pgscan_direct > 0 || rr.allocstall > 0);
+    if (!unit_filter.empty())
+        r.putf(1, x + len + 3, false, "Unit: %.40s (%zu procs)", unit_filter.c_str(), procs.size());
+    // IOW% only while delay accounting fills it; otherwise it would be all zeros
+    r.put(2, 0, sample.io_delay ? TABLE_HEADER : TABLE_HEADER_NO_IOW);
+    int row = 3;
+    formatter.reset_stats();
+    for (size_t i = view.scroll; i < procs.size() && (int)(i - view.scroll) < max_rows; ++i) {
+        int y = row + (i - view.scroll);
+        string_view text = formatter.format(*procs[i], oom_scores.get(*procs[i], stats.samples));
+        if (sample.io_delay) {
+            r.put(y, 0, text);
+        } else {
+            auto [head, tail] = RowFormatter::split_io_wait(text);
+            r.put(y, 0, head);
+            r.put(y, RowFormatter::IOW_AT, tail);
+        }
+    }
+    r.putf(lines - 1, 0, false, "Tick: collect %.1f ms (read %.1f ms, %u threads)  heap allocs %llu  arena %zu/%zu kB  strings %zu (%zu kB)  cells %zu  frame %zu B  samples %llu frames %llu",
+           stats.collect_ms, stats.read_ms, stats.threads, stats.heap_allocs, stats.arena_used / 1024, stats.arena_capacity / 1024,
+           strings.count(), strings.text_bytes() / 1024, formatter.cells_formatted, r.frame_bytes,
+           stats.samples, stats.frames);
+    r.put(lines - 3, 0, "Commands: (s) cycle sort  (k) kill PID  (c) filter unit  (r) refresh  (arrows) scroll  (m/d) mark/diff  (n) NUMA  (h) huge pages  (o) OOM kills  (q) quit");
+    r.end_frame();
 }
 
-ProcSnapshot read_proc(pid_t pid) {
-    ProcSnapshot p{};
-    p.pid = pid;
-    p.cpu_percent = 0.0;
-    p.mem_percent = 0.0;
-    string base = "/proc/" + to_string(pid);
-    // cmdline
-    ifstream fcmd(base + "/cmdline");
-    if (fcmd.is_open()) {
-        string cmd;
-        getline(fcmd, cmd, '\0');
-        if (cmd.empty()) {
-            // fallback to comm
-            ifstream fcomm(base + "/comm");
-            if (fcomm.is_open()) {
-                getline(fcomm, cmd);
+// ---- batch output ----
+
+enum class OutputFormat { Text, Csv, Json };
+
+static void append_csv_field(string &out, string_view v) {
+    if (v.find_first_of(",\"\n") == string_view::npos) {
+        out.append(v.data(), v.size());
+        return;
+    }
+    out += '"';
+    for (char c : v) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+static void append_json_string(string &out, string_view v) {
+    out += '"';
+    for (unsigned char c : v) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char esc[8];
+            out.append(esc, snprintf(esc, sizeof esc, "\\u%04x", c));
+        } else out += (char)c;
+    }
+    out += '"';
+}
+
+template <typename T>
+static void append_number(string &out, T v) {
+    char tmp[32];
+    auto res = to_chars(tmp, tmp + sizeof tmp, v);
+    out.append(tmp, res.ptr);
+}
+
+static void append_fixed2(string &out, double v) {
+    char tmp[32];
+    auto res = to_chars(tmp, tmp + sizeof tmp, v, chars_format::fixed, 2);
+    out.append(tmp, res.ptr);
+}
+
+// ---- recording and columnar export ----
+// Recording (.smr): "SMR3", then one record per sample:
+//   u8 tag ('K' keyframe | 'D' delta), varint nbytes, nbytes of row fields,
+//   varint nbits-bytes, bit stream
+// Records are coded against the previous record: each process row is matched
+// by pid with the row of the previous sample, integers are stored as deltas,
+// strings only when they changed, and the floats (cpu_usage, per-row
+// cpu_percent and mem_percent) plus the timestamp go through the Gorilla
+// coders above. A keyframe resets all state; one is written whenever a
+// recorder opens the file and every KEYFRAME_EVERY samples after that.
+//   row fields: svarint mem_total, svarint mem_used, varint nrows, then per row
+//     svarint pid - previous pid, u8 flags,
+//     new row:   varint starttime, u8 state, varint cpu_time, varint rss_kb, varint io_read,
+//                varint io_write, bytes user, unit, cmd
+//     known row: [u8 state] svarint d(cpu_time) svarint d(rss_kb) svarint d(io_read)
+//                svarint d(io_write) [bytes user] [bytes unit] [bytes cmd]
+//   bit stream: ts_ms (dod), cpu_usage (xor), then cpu_percent, mem_percent (xor) per row
+static const char SMR_MAGIC[] = "SMR3";
+static const int KEYFRAME_EVERY = 300;
+
+enum RowFlags : uint8_t { ROW_NEW = 1, ROW_STATE = 2, ROW_USER = 4, ROW_UNIT = 8, ROW_CMD = 16 };
+
+// One process row as stored in recordings.
+struct RecordedRow {
+    int64_t pid = 0;
+    uint64_t starttime = 0;
+    char state = '?';
+    uint64_t cpu_time = 0; // utime + stime, clock ticks
+    uint64_t rss_kb = 0;
+    uint64_t io_read = 0, io_write = 0; // bytes
+    double cpu_percent = 0.0, mem_percent = 0.0;
+    string user, unit, cmd;
+};
+
+struct RecordedSample {
+    uint64_t ts_ms = 0;
+    double cpu_usage = 0.0;
+    uint64_t mem_total = 0, mem_used = 0;
+    vector<RecordedRow> rows;
+};
+
+class Recorder {
+public:
+    ~Recorder() { close(); }
+
+    bool open(const char *path) {
+        f = fopen(path, "ab");
+        if (!f) return false;
+        if (ftell(f) == 0) fwrite(SMR_MAGIC, 1, 4, f);
+        since_keyframe = KEYFRAME_EVERY; // appending: never code against an older run
+        return true;
+    }
+    void close() {
+        if (f) fclose(f);
+        f = nullptr;
+    }
+    bool is_open() const { return f != nullptr; }
+    uint64_t bytes_written() const { return written; }
+
+    void append(const Sample &sample, uint64_t ts_ms) {
+        bool key = since_keyframe >= KEYFRAME_EVERY;
+        since_keyframe = key ? 1 : since_keyframe + 1;
+        if (key) {
+            seq += 2; // no row of an earlier record matches "seq - 1"
+            ts = DodState();
+            cpu_usage = XorState();
+            mem_total = mem_used = 0;
+        }
+        ++seq;
+        w.buf.clear();
+        bits.clear();
+        dod_encode(bits, ts, (int64_t)ts_ms);
+        xor_encode(bits, cpu_usage, sample.cpu_usage);
+        w.svarint((int64_t)sample.mem_total - (int64_t)mem_total);
+        w.svarint((int64_t)sample.mem_used - (int64_t)mem_used);
+        mem_total = sample.mem_total;
+        mem_used = sample.mem_used;
+        w.varint(sample.procs.size());
+        pid_t prev_pid = 0;
+        for (const ProcSnapshot &p : sample.procs) {
+            w.svarint((int64_t)p.pid - prev_pid);
+            prev_pid = p.pid;
+            auto &slot = rows.slot(p.pid);
+            Row &r = slot.value;
+            bool known = slot.stamp == seq - 1 && r.starttime == p.starttime;
+            slot.stamp = seq;
+            if (!known) {
+                w.u8(ROW_NEW);
+                w.varint(p.starttime);
+                w.u8(p.state);
+                w.varint(p.total_time());
+                w.varint(p.rss);
+                w.varint(p.io_read);
+                w.varint(p.io_write);
+                w.bytes(strings.str(p.user));
+                w.bytes(strings.str(p.unit));
+                w.bytes(strings.str(p.cmd));
+                r = Row();
+            } else {
+                uint8_t flags = (r.state != p.state ? ROW_STATE : 0) | (r.user != p.user ? ROW_USER : 0) |
+                                (r.unit != p.unit ? ROW_UNIT : 0) | (r.cmd != p.cmd ? ROW_CMD : 0);
+                w.u8(flags);
+                if (flags & ROW_STATE) w.u8(p.state);
+                w.svarint((int64_t)p.total_time() - (int64_t)r.cpu_time);
+                w.svarint((int64_t)p.rss - (int64_t)r.rss);
+                w.svarint((int64_t)p.io_read - (int64_t)r.io_read);
+                w.svarint((int64_t)p.io_write - (int64_t)r.io_write);
+                if (flags & ROW_USER) w.bytes(strings.str(p.user));
+                if (flags & ROW_UNIT) w.bytes(strings.str(p.unit));
+                if (flags & ROW_CMD) w.bytes(strings.str(p.cmd));
             }
+            r.starttime = p.starttime;
+            r.state = p.state;
+            r.cpu_time = p.total_time();
+            r.rss = p.rss;
+            r.io_read = p.io_read;
+            r.io_write = p.io_write;
+            r.user = p.user;
+            r.unit = p.unit;
+            r.cmd = p.cmd;
+            xor_encode(bits, r.cpu, p.cpu_percent);
+            xor_encode(bits, r.mem, p.mem_percent);
         }
-        // replace '\0' with ' '
-        for (char &c : cmd) if (c == '\0') c = ' ';
-        p.cmd = cmd;
-    } else {
-        p.cmd = "";
+        header.buf.clear();
+        header.u8(key ? 'K' : 'D');
+        header.varint(w.buf.size());
+        header.buf += w.buf;
+        header.varint(bits.buf.size());
+        header.buf += bits.buf;
+        fwrite(header.buf.data(), 1, header.buf.size(), f);
+        fflush(f);
+        written += header.buf.size();
     }
 
-    // read stat
-    ifstream fstat(base + "/stat");
-    if (fstat.is_open()) {
-        // fields: pid (1) comm (2) state (3) ... utime (14) stime (15) ... rss (24)
-        string content;
-        getline(fstat, content);
-        stringstream ss(content);
-        string token;
-        vector<string> fields;
-        while (ss >> token) fields.push_back(token);
-        if (fields.size() >= 24) {
-            unsigned long long utime = stoull(fields[13]);
-            unsigned long long stime = stoull(fields[14]);
-            long rss_pages = stol(fields[23]);
-            long page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
-            p.utime = utime;
-            p.stime = stime;
-            p.rss = rss_pages * page_size_kb; // in KB
+private:
+    // Last recorded values of one process; strings are handles, which stay
+    // valid as long as the process is seen every tick.
+    struct Row {
+        unsigned long long starttime = 0;
+        char state = 0;
+        unsigned long long cpu_time = 0, rss = 0, io_read = 0, io_write = 0;
+        StrId user = 0, unit = 0, cmd = 0;
+        XorState cpu, mem;
+    };
+    FILE *f = nullptr;
+    PidTable<Row> rows; // stamp = record seq the row was last written in
+    unsigned long long seq = 1;
+    int since_keyframe = 0;
+    DodState ts;
+    XorState cpu_usage;
+    uint64_t mem_total = 0, mem_used = 0;
+    ByteWriter w, header; // reused between samples
+    BitWriter bits;
+    uint64_t written = 0;
+};
+
+// Reads a recording sample by sample.
+class RecordingReader {
+public:
+    bool open(const char *path, string &err) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            err = string("cannot open ") + path;
+            return false;
+        }
+        data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        if (data.compare(0, 4, SMR_MAGIC) != 0) {
+            err = string(path) + " is not a sysmon recording";
+            return false;
         }
+        pos = 4;
+        return true;
     }
 
-    // read status for uid
-    ifstream fstatus(base + "/status");
-    if (fstatus.is_open()) {
-        string line;
-        while (getline(fstatus, line)) {
-            if (line.rfind("Uid:", 0) == 0) {
-                stringstream ss(line);
-                string label; uid_t real_uid;
-                ss >> label >> real_uid;
-                p.user = uid_to_user(real_uid);
+    // False at end of file or on a truncated record (e.g. recorder killed mid-write).
+    bool next(RecordedSample &s) {
+        ByteReader rec(string_view(data).substr(pos));
+        if (rec.data.empty()) return false;
+        uint8_t tag = rec.u8();
+        if (tag != 'K' && tag != 'D') return false;
+        if (tag == 'K') {
+            rows.clear();
+            ts = DodState();
+            cpu_usage = XorState();
+            mem_total = mem_used = 0;
+        } else if (!synced) {
+            return false;
+        }
+        synced = true;
+        ByteReader r(rec.bytes());
+        BitReader bits(rec.bytes());
+        if (!rec.ok) return false;
+
+        s.ts_ms = (uint64_t)dod_decode(bits, ts);
+        s.cpu_usage = xor_decode(bits, cpu_usage);
+        s.mem_total = mem_total += r.svarint();
+        s.mem_used = mem_used += r.svarint();
+        size_t n = r.varint();
+        s.rows.resize(r.ok ? min<size_t>(n, r.data.size()) : 0);
+        unordered_map<int64_t, Row> next_rows;
+        next_rows.reserve(s.rows.size());
+        int64_t pid = 0;
+        for (RecordedRow &row : s.rows) {
+            pid += r.svarint();
+            uint8_t flags = r.u8();
+            Row st;
+            if (!(flags & ROW_NEW)) {
+                auto it = rows.find(pid);
+                if (it == rows.end()) return false;
+                st = move(it->second);
             }
+            row.pid = pid;
+            if (flags & ROW_NEW) {
+                row.starttime = r.varint();
+                row.state = (char)r.u8();
+                row.cpu_time = r.varint();
+                row.rss_kb = r.varint();
+                row.io_read = r.varint();
+                row.io_write = r.varint();
+                row.user = r.bytes();
+                row.unit = r.bytes();
+                row.cmd = r.bytes();
+            } else {
+                row.starttime = st.last.starttime;
+                row.state = flags & ROW_STATE ? (char)r.u8() : st.last.state;
+                row.cpu_time = st.last.cpu_time + r.svarint();
+                row.rss_kb = st.last.rss_kb + r.svarint();
+                row.io_read = st.last.io_read + r.svarint();
+                row.io_write = st.last.io_write + r.svarint();
+                row.user = flags & ROW_USER ? string(r.bytes()) : st.last.user;
+                row.unit = flags & ROW_UNIT ? string(r.bytes()) : st.last.unit;
+                row.cmd = flags & ROW_CMD ? string(r.bytes()) : st.last.cmd;
+            }
+            row.cpu_percent = xor_decode(bits, st.cpu);
+            row.mem_percent = xor_decode(bits, st.mem);
+            st.last = row;
+            next_rows.emplace(pid, move(st));
+        }
+        if (!r.ok || !bits.ok) return false;
+        rows.swap(next_rows);
+        pos = data.size() - rec.data.size();
+        return true;
+    }
+
+private:
+    struct Row {
+        RecordedRow last;
+        XorState cpu, mem;
+    };
+    string data;
+    size_t pos = 0;
+    bool synced = false; // a keyframe has been read
+    unordered_map<int64_t, Row> rows; // rows of the previous record by pid
+    DodState ts;
+    XorState cpu_usage;
+    uint64_t mem_total = 0, mem_used = 0;
+};
+
+// Rollup file (.smx): fixed-size round-robin tiers of min/max/avg buckets, so
+// long ranges can be read without keeping raw samples forever.
+//   "SMX1" u32 ntiers, per tier {u32 resolution_s, u32 buckets}
+//   u32 nseries, per series bytes name
+//   then each tier's buckets back to back; bucket = u64 start_ms (0 = empty),
+//   u32 count, per series {f64 min, f64 max, f64 sum}
+// A sample updates one bucket per tier in place (the bucket of its timestamp,
+// slot = start / resolution % buckets), so the file never grows and a stale
+// slot is recognized by its start time.
+static const char SMX_MAGIC[] = "SMX1";
+
+struct RollupTier {
+    uint32_t resolution_s, buckets;
+};
+static const RollupTier rollup_tiers[] = {
+    {1, 3600},   // 1 s for 1 hour
+    {10, 8640},  // 10 s for 1 day
+    {60, 43200}, // 1 min for 30 days
+};
+static const char *const rollup_series[] = {"cpu_percent", "mem_used_kb", "procs", "running", "blocked"};
+static const size_t ROLLUP_SERIES = size(rollup_series);
+
+struct RollupBucket {
+    uint64_t start_ms = 0;
+    uint32_t count = 0;
+    double min[ROLLUP_SERIES] = {}, max[ROLLUP_SERIES] = {}, sum[ROLLUP_SERIES] = {};
+
+    static const size_t BYTES = 12 + 24 * ROLLUP_SERIES;
+
+    void add(const double *v) {
+        for (size_t i = 0; i < ROLLUP_SERIES; ++i) {
+            min[i] = count ? std::min(min[i], v[i]) : v[i];
+            max[i] = count ? std::max(max[i], v[i]) : v[i];
+            sum[i] = count ? sum[i] + v[i] : v[i];
+        }
+        ++count;
+    }
+    double avg(size_t i) const { return count ? sum[i] / count : 0.0; }
+    void write(ByteWriter &w) const {
+        w.u64(start_ms);
+        w.u32(count);
+        for (size_t i = 0; i < ROLLUP_SERIES; ++i) {
+            w.f64(min[i]);
+            w.f64(max[i]);
+            w.f64(sum[i]);
+        }
+    }
+    void read(ByteReader &r) {
+        start_ms = r.u64();
+        count = r.u32();
+        for (size_t i = 0; i < ROLLUP_SERIES; ++i) {
+            min[i] = r.f64();
+            max[i] = r.f64();
+            sum[i] = r.f64();
         }
     }
+};
 
-    return p;
+// Series values of one sample, in rollup_series order.
+void rollup_values(const Sample &s, double *v) {
+    size_t running = 0, blocked = 0;
+    for (const ProcSnapshot &p : s.procs) {
+        running += p.state == 'R';
+        blocked += p.state == 'D';
+    }
+    v[0] = s.cpu_usage;
+    v[1] = (double)s.mem_used;
+    v[2] = (double)s.procs.size();
+    v[3] = (double)running;
+    v[4] = (double)blocked;
 }
 
-vector<pid_t> list_pids() {
-    vector<pid_t> pids;
-    DIR *d = opendir("/proc");
-    if (!d) return pids;
-    struct dirent *entry;
-    while ((entry = readdir(d)) != nullptr) {
-        if (entry->d_type == DT_DIR) {
-            string name = entry->d_name;
-            if (is_number(name)) {
-                pids.push_back(stoi(name));
+// Reads and incrementally updates a rollup file.
+class RollupStore {
+public:
+    ~RollupStore() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Opens (or creates) path; an existing file must have the built-in layout.
+    bool open(const char *path, bool writable, string &err) {
+        fd = ::open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            err = string("cannot open ") + path + ": " + strerror(errno);
+            return false;
+        }
+        ByteWriter h;
+        h.buf.append(SMX_MAGIC, 4);
+        h.u32(size(rollup_tiers));
+        for (const RollupTier &t : rollup_tiers) {
+            h.u32(t.resolution_s);
+            h.u32(t.buckets);
+        }
+        h.u32(ROLLUP_SERIES);
+        for (const char *name : rollup_series) h.bytes(name);
+        header_size = h.buf.size();
+        uint64_t file_size = header_size;
+        for (const RollupTier &t : rollup_tiers) {
+            tier_offset.push_back(file_size);
+            file_size += (uint64_t)t.buckets * RollupBucket::BYTES;
+        }
+        if (st.st_size == 0 && writable) {
+            // new file: header, then all tiers as empty (zero) buckets
+            if (pwrite(fd, h.buf.data(), h.buf.size(), 0) != (ssize_t)h.buf.size() || ftruncate(fd, file_size) != 0) {
+                err = string("cannot write ") + path + ": " + strerror(errno);
+                return false;
+            }
+        } else {
+            string on_disk(h.buf.size(), '\0');
+            if ((uint64_t)st.st_size != file_size || pread(fd, &on_disk[0], on_disk.size(), 0) != (ssize_t)on_disk.size() ||
+                on_disk != h.buf) {
+                err = string(path) + " is not a sysmon rollup file with this tier layout";
+                return false;
             }
         }
+        current.assign(size(rollup_tiers), RollupBucket());
+        return true;
     }
-    closedir(d);
-    return pids;
-}
 
-int main() {
-    // initialize
-    initscr();
-    cbreak();
-    noecho();
-    nodelay(stdscr, TRUE); // non-blocking getch
-    keypad(stdscr, TRUE);
-    curs_set(0);
+    // Folds one sample into the current bucket of every tier.
+    void add(uint64_t ts_ms, const double *values) {
+        for (size_t t = 0; t < size(rollup_tiers); ++t) {
+            uint64_t res_ms = rollup_tiers[t].resolution_s * 1000ull;
+            uint64_t start = ts_ms - ts_ms % res_ms;
+            RollupBucket &b = current[t];
+            if (b.start_ms != start) {
+                // a bucket interrupted by a restart is continued, a stale slot reset
+                if (!read_bucket(t, start / res_ms % rollup_tiers[t].buckets, b) || b.start_ms != start) {
+                    b = RollupBucket();
+                    b.start_ms = start;
+                }
+            }
+            b.add(values);
+            scratch.buf.clear();
+            b.write(scratch);
+            pwrite(fd, scratch.buf.data(), scratch.buf.size(), slot_offset(t, start / res_ms % rollup_tiers[t].buckets));
+        }
+    }
 
-    Hertz = sysconf(_SC_CLK_TCK);
-    total_mem_kb_cache = read_total_memory_kb();
+    // Buckets of tier t that start within [from_ms, to_ms], oldest first. Only
+    // the slots covering the range are read.
+    bool read_range(size_t t, uint64_t from_ms, uint64_t to_ms, vector<RollupBucket> &out) const {
+        out.clear();
+        uint64_t res_ms = rollup_tiers[t].resolution_s * 1000ull, n = rollup_tiers[t].buckets;
+        if (to_ms < from_ms) return true;
+        uint64_t first = from_ms / res_ms, last = to_ms / res_ms;
+        uint64_t count = min(last - first + 1, n);
+        first = last + 1 - count;
+        string raw(count * RollupBucket::BYTES, '\0');
+        // the range wraps around the end of the ring at most once
+        uint64_t slot = first % n, head = min(count, n - slot);
+        if (pread(fd, &raw[0], head * RollupBucket::BYTES, slot_offset(t, slot)) != (ssize_t)(head * RollupBucket::BYTES))
+            return false;
+        if (head < count && pread(fd, &raw[head * RollupBucket::BYTES], (count - head) * RollupBucket::BYTES,
+                                  slot_offset(t, 0)) != (ssize_t)((count - head) * RollupBucket::BYTES))
+            return false;
+        ByteReader r(raw);
+        for (uint64_t i = 0; i < count; ++i) {
+            RollupBucket b;
+            b.read(r);
+            if (b.count && b.start_ms >= from_ms - from_ms % res_ms && b.start_ms <= to_ms) out.push_back(b);
+        }
+        return r.ok;
+    }
 
-    CpuSnapshot prev_cpu = read_cpu_line();
-    unordered_map<pid_t, ProcSnapshot> prev_procs;
+private:
+    int fd = -1;
+    size_t header_size = 0;
+    vector<uint64_t> tier_offset;
+    vector<RollupBucket> current; // bucket being filled, per tier
+    ByteWriter scratch;
 
-    while (true) {
-        // handle input
-        int ch = getch();
-        if (ch == 'q' || ch == 'Q') break;
-        else if (ch == 's' || ch == 'S') sort_by_cpu = !sort_by_cpu;
-        else if (ch == 'r' || ch == 'R') {
-            // force refresh, nothing needed since we refresh each loop
-        } else if (ch == 'k' || ch == 'K') {
-            // ask user for PID (blocking read)
-            echo();
-            curs_set(1);
-            nodelay(stdscr, FALSE);
-            mvprintw(LINES - 2, 0, "Enter PID to kill: ");
-            clrtoeol();
-            char buf[32];
-            getnstr(buf, 31);
-            int pid = atoi(buf);
-            if (pid > 0) {
-                int res = kill(pid, SIGTERM);
-                if (res == 0) {
-                    mvprintw(LINES - 2, 0, "Sent SIGTERM to %d. Press any key to continue...", pid);
-                } else {
-                    mvprintw(LINES - 2, 0, "Failed to kill %d (errno %d). Press any key to continue...", pid, errno);
-                }
-            } else {
-                mvprintw(LINES - 2, 0, "Invalid PID. Press any key to continue...");
-            }
-            getch();
-            nodelay(stdscr, TRUE);
-            noecho();
-            curs_set(0);
-        }
-
-        // read current CPU snapshot
-        CpuSnapshot cur_cpu = read_cpu_line();
-        unsigned long long prev_tot = prev_cpu.total();
-        unsigned long long cur_tot = cur_cpu.total();
-        unsigned long long tot_diff = cur_tot - prev_tot;
-        unsigned long long idle_diff = cur_cpu.idleAll() - prev_cpu.idleAll();
-        double cpu_usage = 0.0; // percent
-        if (tot_diff > 0) cpu_usage = 100.0 * (double)(tot_diff - idle_diff) / (double)tot_diff;
-
-        // memory
-        unsigned long long mem_total = total_mem_kb_cache;
-        unsigned long long mem_free = 0, mem_available = 0;
-        ifstream fmem("/proc/meminfo");
-        string line;
-        while (getline(fmem, line)) {
-            if (line.rfind("MemAvailable:", 0) == 0) {
-                stringstream ss(line);
-                string label; unsigned long long val; string unit;
-                ss >> label >> val >> unit;
-                mem_available = val;
-            } else if (line.rfind("MemFree:", 0) == 0) {
-                stringstream ss(line);
-                string label; unsigned long long val; string unit;
-                ss >> label >> val >> unit;
-                mem_free = val;
-            }
-        }
-        unsigned long long mem_used = 0;
-        if (mem_total > mem_available) mem_used = mem_total - mem_available;
-        else mem_used = mem_total - mem_free;
-
-        // read processes
-        vector<pid_t> pids = list_pids();
-        vector<ProcSnapshot> procs;
-        procs.reserve(pids.size());
-        for (pid_t pid : pids) {
-            ProcSnapshot cur = read_proc(pid);
-            // compute cpu percent relative to previous snapshot
-            double cpu_pct = 0.0;
-            if (prev_procs.count(pid)) {
-                unsigned long long prev_total_time = prev_procs[pid].total_time();
-                unsigned long long cur_total_time = cur.total_time();
-                unsigned long long proc_time_diff = 0;
-                if (cur_total_time >= prev_total_time) proc_time_diff = cur_total_time - prev_total_time;
-                if (tot_diff > 0) {
-                    // cpu % = (proc_time_diff / Hertz) / (tot_diff / Hertz) * 100
-                    // simplified: proc_time_diff / tot_diff * 100
-                    cpu_pct = 100.0 * (double)proc_time_diff / (double)tot_diff;
+    uint64_t slot_offset(size_t t, uint64_t slot) const { return tier_offset[t] + slot * RollupBucket::BYTES; }
+
+    bool read_bucket(size_t t, uint64_t slot, RollupBucket &b) const {
+        char raw[RollupBucket::BYTES];
+        if (pread(fd, raw, sizeof raw, slot_offset(t, slot)) != (ssize_t)sizeof raw) return false;
+        ByteReader r(string_view(raw, sizeof raw));
+        b.read(r);
+        return r.ok;
+    }
+};
+
+// Columnar file (.smc), for offline analytics:
+//   "SMC1" u32 version
+//   column chunks, each one contiguous encoded column of one row group
+//   footer: varint ncols, per column {bytes name, u8 type}
+//           varint nchunks, per chunk {varint rows,
+//               per column {u64 offset, u64 size, u8 encoding, u64 min, u64 max}}
+//   u64 footer offset, "SMC1"
+// min/max are int64 or double bit patterns by column type (0 for strings), so a
+// reader can skip whole chunks by time, pid or value range without reading them.
+// Within a chunk rows are ordered by (pid, starttime, ts_ms), so each process's
+// samples are contiguous and the Gorilla coders see real time series; the
+// series restarts (coder state reset) where (pid, starttime) changes.
+enum class ColType : uint8_t { Int = 1, Float = 2, String = 3 };
+enum class Encoding : uint8_t {
+    DeltaVarint = 1, // zigzag varint of the difference to the previous value
+    PlainF64 = 2,    // 8 bytes little-endian per value
+    Dict = 3,        // varint ndict, ndict x bytes, then varint id per row
+    GorillaF64 = 4,  // XOR float bit stream, one series per (pid, starttime) run
+    DeltaOfDelta = 5, // delta-of-delta bit stream, one series per (pid, starttime) run
+};
+static const char SMC_MAGIC[] = "SMC1";
+static const uint32_t SMC_VERSION = 1;
+
+struct ColumnDef {
+    const char *name;
+    ColType type;
+};
+
+// Columns written by the exporter, in file order.
+static const ColumnDef columnar_schema[] = {
+    {"ts_ms", ColType::Int}, {"pid", ColType::Int}, {"starttime", ColType::Int},
+    {"state", ColType::Int}, {"cpu_time", ColType::Int}, {"rss_kb", ColType::Int},
+    {"io_read", ColType::Int}, {"io_write", ColType::Int}, {"cpu_percent", ColType::Float}, {"mem_percent", ColType::Float},
+    {"user", ColType::String}, {"unit", ColType::String}, {"cmd", ColType::String},
+};
+enum SchemaColumn { C_TS, C_PID, C_STARTTIME, C_STATE, C_CPU_TIME, C_RSS, C_IO_READ, C_IO_WRITE, C_CPU, C_MEM, C_USER, C_UNIT, C_CMD, C_COUNT };
+
+// One column of one row group while it is being filled.
+struct ColumnBuilder {
+    ColType type;
+    vector<int64_t> ints;
+    vector<double> floats;
+    vector<uint32_t> ids;
+    vector<string> dict;
+    unordered_map<string, uint32_t> dict_index;
+
+    void add(int64_t v) { ints.push_back(v); }
+    void add(double v) { floats.push_back(v); }
+    void add(const string &v) {
+        auto it = dict_index.find(v);
+        if (it == dict_index.end()) {
+            it = dict_index.emplace(v, (uint32_t)dict.size()).first;
+            dict.push_back(v);
+        }
+        ids.push_back(it->second);
+    }
+    void clear() {
+        ints.clear();
+        floats.clear();
+        ids.clear();
+        dict.clear();
+        dict_index.clear();
+    }
+
+    // Reorders the rows: row i becomes old row order[i].
+    void permute(const vector<uint32_t> &order) {
+        if (!ints.empty()) { vector<int64_t> t(ints.size()); for (size_t i = 0; i < order.size(); ++i) t[i] = ints[order[i]]; ints.swap(t); }
+        if (!floats.empty()) { vector<double> t(floats.size()); for (size_t i = 0; i < order.size(); ++i) t[i] = floats[order[i]]; floats.swap(t); }
+        if (!ids.empty()) { vector<uint32_t> t(ids.size()); for (size_t i = 0; i < order.size(); ++i) t[i] = ids[order[i]]; ids.swap(t); }
+    }
+
+    // Encodes the column into w; returns the encoding and min/max bit patterns.
+    // series_start[i] is true where row i starts a new series.
+    Encoding encode(ByteWriter &w, uint64_t &min_bits, uint64_t &max_bits, bool timestamps,
+                    const vector<bool> &series_start) const {
+        min_bits = max_bits = 0;
+        switch (type) {
+        case ColType::Int: {
+            if (!ints.empty()) {
+                auto mm = minmax_element(ints.begin(), ints.end());
+                min_bits = (uint64_t)*mm.first;
+                max_bits = (uint64_t)*mm.second;
+            }
+            if (timestamps) {
+                BitWriter bits;
+                DodState st;
+                for (size_t i = 0; i < ints.size(); ++i) {
+                    if (series_start[i]) st = DodState();
+                    dod_encode(bits, st, ints[i]);
                 }
+                w.buf += bits.buf;
+                return Encoding::DeltaOfDelta;
+            }
+            int64_t prev = 0;
+            for (int64_t v : ints) {
+                w.svarint(v - prev);
+                prev = v;
+            }
+            return Encoding::DeltaVarint;
+        }
+        case ColType::Float: {
+            BitWriter bits;
+            XorState st;
+            for (size_t i = 0; i < floats.size(); ++i) {
+                if (series_start[i]) st = XorState();
+                xor_encode(bits, st, floats[i]);
             }
-            cur.cpu_percent = cpu_pct;
-            // mem %
-            if (mem_total > 0) {
-                cur.mem_percent = 100.0 * (double)cur.rss / (double)mem_total;
-            } else cur.mem_percent = 0.0;
-            procs.push_back(cur);
+            w.buf += bits.buf;
+            if (!floats.empty()) {
+                auto mm = minmax_element(floats.begin(), floats.end());
+                min_bits = f64_bits(*mm.first);
+                max_bits = f64_bits(*mm.second);
+            }
+            return Encoding::GorillaF64;
+        }
+        case ColType::String:
+            w.varint(dict.size());
+            for (const string &d : dict) w.bytes(d);
+            for (uint32_t id : ids) w.varint(id);
+            return Encoding::Dict;
         }
+        return Encoding::DeltaVarint;
+    }
+};
 
-        // update previous proc map
-        prev_procs.clear();
-        for (auto &p : procs) prev_procs[p.pid] = p;
-        prev_cpu = cur_cpu;
+class ColumnarWriter {
+public:
+    explicit ColumnarWriter(size_t chunk_rows) : chunk_rows(max<size_t>(chunk_rows, 1)) {
+        for (const ColumnDef &c : columnar_schema) cols.push_back(ColumnBuilder{c.type, {}, {}, {}, {}, {}});
+    }
 
-        // sort
-        if (sort_by_cpu) {
-            sort(procs.begin(), procs.end(), [](const ProcSnapshot &a, const ProcSnapshot &b){
-                if (a.cpu_percent == b.cpu_percent) return a.mem_percent > b.mem_percent;
-                return a.cpu_percent > b.cpu_percent;
-            });
-        } else {
-            sort(procs.begin(), procs.end(), [](const ProcSnapshot &a, const ProcSnapshot &b){
-                if (a.mem_percent == b.mem_percent) return a.cpu_percent > b.cpu_percent;
-                return a.mem_percent > b.mem_percent;
-            });
+    bool open(const char *path) {
+        f = fopen(path, "wb");
+        if (!f) return false;
+        ByteWriter w;
+        w.buf.append(SMC_MAGIC, 4);
+        w.u32(SMC_VERSION);
+        write(w.buf);
+        return true;
+    }
+
+    void add(const RecordedSample &s) {
+        for (const RecordedRow &r : s.rows) {
+            cols[C_TS].add((int64_t)s.ts_ms);
+            cols[C_PID].add(r.pid);
+            cols[C_STARTTIME].add((int64_t)r.starttime);
+            cols[C_STATE].add((int64_t)r.state);
+            cols[C_CPU_TIME].add((int64_t)r.cpu_time);
+            cols[C_RSS].add((int64_t)r.rss_kb);
+            cols[C_IO_READ].add((int64_t)r.io_read);
+            cols[C_IO_WRITE].add((int64_t)r.io_write);
+            cols[C_CPU].add(r.cpu_percent);
+            cols[C_MEM].add(r.mem_percent);
+            cols[C_USER].add(r.user);
+            cols[C_UNIT].add(r.unit);
+            cols[C_CMD].add(r.cmd);
+            ++rows;
         }
+        // row groups end on sample boundaries so a sample is never split
+        if (rows >= chunk_rows) flush_chunk();
+    }
 
-        // draw UI
-        erase();
-        attron(A_BOLD);
-        mvprintw(0, 0, "SysMon - simple system monitor (press q to quit)   Refresh: %ds   Sort: %s",
-                 REFRESH_INTERVAL, sort_by_cpu ? "CPU" : "MEM");
-        attroff(A_BOLD);
-        mvprintw(1, 0, "CPU Usage: %.2f%%   Mem: %llu kB total   Used: %llu kB (approx)",
-                 cpu_usage, mem_total, mem_used);
-        mvprintw(2, 0, "PID     USER       %%CPU   %%MEM   RSS(kB)   CMD");
-        int row = 3;
-        int max_rows = LINES - 5;
-        for (size_t i = 0; i < procs.size() && i < (size_t)max_rows; ++i) {
-            const auto &p = procs[i];
-            mvprintw(row + i, 0, "%-7d %-10.10s %6.2f %7.2f %10llu  %.40s",
-                     p.pid, p.user.c_str(), p.cpu_percent, p.mem_percent, p.rss, p.cmd.c_str());
-        }
-        mvprintw(LINES - 3, 0, "Commands: (s) toggle sort  (k) kill PID  (r) refresh  (q) quit");
-        refresh();
+    bool finish() {
+        flush_chunk();
+        ByteWriter w;
+        w.varint(C_COUNT);
+        for (const ColumnDef &c : columnar_schema) {
+            w.bytes(c.name);
+            w.u8((uint8_t)c.type);
+        }
+        w.varint(nchunks);
+        w.buf += index.buf;
+        uint64_t footer_at = offset;
+        w.u64(footer_at);
+        w.buf.append(SMC_MAGIC, 4);
+        write(w.buf);
+        bool ok = !ferror(f);
+        ok = fclose(f) == 0 && ok;
+        f = nullptr;
+        return ok;
+    }
+
+    uint64_t bytes_written() const { return offset; }
+    size_t chunks() const { return nchunks; }
+
+private:
+    size_t chunk_rows;
+    vector<ColumnBuilder> cols;
+    size_t rows = 0, nchunks = 0;
+    FILE *f = nullptr;
+    uint64_t offset = 0;
+    ByteWriter index; // chunk entries of the footer
+
+    void write(const string &b) {
+        fwrite(b.data(), 1, b.size(), f);
+        offset += b.size();
+    }
+
+    void flush_chunk() {
+        if (rows == 0) return;
+        // order rows by series so each process's samples are contiguous
+        vector<uint32_t> order(rows);
+        iota(order.begin(), order.end(), 0);
+        const auto &pid = cols[C_PID].ints, &start = cols[C_STARTTIME].ints, &ts = cols[C_TS].ints;
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return tie(pid[a], start[a], ts[a]) < tie(pid[b], start[b], ts[b]);
+        });
+        for (ColumnBuilder &c : cols) c.permute(order);
+        vector<bool> series_start(rows);
+        for (size_t i = 0; i < rows; ++i)
+            series_start[i] = i == 0 || pid[i] != pid[i - 1] || start[i] != start[i - 1];
+
+        index.varint(rows);
+        ByteWriter w;
+        for (size_t ci = 0; ci < cols.size(); ++ci) {
+            ColumnBuilder &c = cols[ci];
+            w.buf.clear();
+            uint64_t lo, hi;
+            Encoding enc = c.encode(w, lo, hi, ci == C_TS, series_start);
+            index.u64(offset);
+            index.u64(w.buf.size());
+            index.u8((uint8_t)enc);
+            index.u64(lo);
+            index.u64(hi);
+            write(w.buf);
+            c.clear();
+        }
+        rows = 0;
+        ++nchunks;
+    }
+};
+
+// Reads columnar files. Column chunks are fetched with pread, so one reader
+// can serve several threads at once.
+class ColumnarReader {
+public:
+    struct Column {
+        string name;
+        ColType type;
+    };
+    struct ColumnChunk {
+        uint64_t offset, size;
+        Encoding encoding;
+        uint64_t min_bits, max_bits;
+        int64_t min_int() const { return (int64_t)min_bits; }
+        int64_t max_int() const { return (int64_t)max_bits; }
+        double min_float() const { return bits_f64(min_bits); }
+        double max_float() const { return bits_f64(max_bits); }
+    };
+    struct Chunk {
+        uint64_t rows;
+        vector<ColumnChunk> cols;
+    };
 
-        // sleep for interval but still allow user input to be responsive
-        for (int i = 0; i < REFRESH_INTERVAL * 10; ++i) {
-            napms(100);
-            int c = getch();
-            if (c == 'q' || c == 'Q') goto cleanup;
-            else if (c == 's' || c == 'S') {
-                sort_by_cpu = !sort_by_cpu;
-                break;
-            } else if (c == 'k' || c == 'K') {
-                // we will handle on top of loop (force user input)
-                ungetch('k');
-                break;
+    vector<Column> columns;
+    vector<Chunk> chunks;
+
+    ~ColumnarReader() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool open(const char *path, string &err) {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            err = string("cannot open ") + path;
+            return false;
+        }
+        string tail(12, '\0');
+        if (st.st_size < 20 || pread(fd, &tail[0], 12, st.st_size - 12) != 12 || tail.compare(8, 4, SMC_MAGIC) != 0) {
+            err = string(path) + " is not a sysmon columnar file";
+            return false;
+        }
+        uint64_t footer_at = ByteReader(tail).u64();
+        if (footer_at >= (uint64_t)st.st_size - 12) {
+            err = string(path) + ": bad footer offset";
+            return false;
+        }
+        string footer(st.st_size - 12 - footer_at, '\0');
+        if (pread(fd, &footer[0], footer.size(), footer_at) != (ssize_t)footer.size()) {
+            err = string(path) + ": short read";
+            return false;
+        }
+        ByteReader r(footer);
+        // the counts are checked against the footer size before anything is
+        // allocated for them: a column takes at least 2 bytes (name length,
+        // type), a chunk 1 + 33 per column (rows, offset/size/encoding/min/max)
+        uint64_t ncols = r.varint();
+        if (!r.ok || ncols > footer.size() / 2) {
+            err = string(path) + ": corrupt footer";
+            return false;
+        }
+        columns.resize(ncols);
+        for (Column &c : columns) {
+            c.name = string(r.bytes());
+            c.type = (ColType)r.u8();
+        }
+        uint64_t nchunks = r.ok ? r.varint() : 0;
+        if (!r.ok || nchunks > footer.size() / (1 + 33 * columns.size())) {
+            err = string(path) + ": corrupt footer";
+            return false;
+        }
+        chunks.resize(nchunks);
+        for (Chunk &ch : chunks) {
+            ch.rows = r.varint();
+            ch.cols.resize(columns.size());
+            for (ColumnChunk &cc : ch.cols) {
+                cc.offset = r.u64();
+                cc.size = r.u64();
+                cc.encoding = (Encoding)r.u8();
+                cc.min_bits = r.u64();
+                cc.max_bits = r.u64();
             }
         }
+        if (!r.ok) {
+            err = string(path) + ": corrupt footer";
+            return false;
+        }
+        return true;
     }
 
-cleanup:
-    endwin();
-    return 0;
-}
\ No newline at end of file
+    int column(string_view name) const {
+        for (size_t i = 0; i < columns.size(); ++i) if (columns[i].name == name) return (int)i;
+        return -1;
+    }
+
+    uint64_t total_rows() const {
+        uint64_t n = 0;
+        for (const Chunk &c : chunks) n += c.rows;
+        return n;
+    }
+
+    bool read_ints(size_t chunk, int col, vector<int64_t> &out) const {
+        string raw;
+        const ColumnChunk *cc = fetch(chunk, col, raw);
+        if (!cc) return false;
+        out.resize(chunks[chunk].rows);
+        if (cc->encoding == Encoding::DeltaVarint) {
+            ByteReader r(raw);
+            int64_t prev = 0;
+            for (int64_t &v : out) v = prev += r.svarint();
+            return r.ok;
+        }
+        if (cc->encoding == Encoding::DeltaOfDelta) {
+            const vector<bool> *starts = series_starts(chunk);
+            if (!starts) return false;
+            BitReader r(raw);
+            DodState st;
+            for (size_t i = 0; i < out.size(); ++i) {
+                if ((*starts)[i]) st = DodState();
+                out[i] = dod_decode(r, st);
+            }
+            return r.ok;
+        }
+        return false;
+    }
+
+    bool read_floats(size_t chunk, int col, vector<double> &out) const {
+        string raw;
+        const ColumnChunk *cc = fetch(chunk, col, raw);
+        if (!cc) return false;
+        out.resize(chunks[chunk].rows);
+        if (cc->encoding == Encoding::PlainF64) {
+            ByteReader r(raw);
+            for (double &v : out) v = r.f64();
+            return r.ok;
+        }
+        if (cc->encoding == Encoding::GorillaF64) {
+            const vector<bool> *starts = series_starts(chunk);
+            if (!starts) return false;
+            BitReader r(raw);
+            XorState st;
+            for (size_t i = 0; i < out.size(); ++i) {
+                if ((*starts)[i]) st = XorState();
+                out[i] = xor_decode(r, st);
+            }
+            return r.ok;
+        }
+        return false;
+    }
+
+    // Dictionary and per-row ids of a string column.
+    bool read_strings(size_t chunk, int col, vector<string> &dict, vector<uint32_t> &ids) const {
+        string raw;
+        const ColumnChunk *cc = fetch(chunk, col, raw);
+        if (!cc || cc->encoding != Encoding::Dict) return false;
+        ByteReader r(raw);
+        dict.resize(r.varint());
+        for (string &d : dict) d = string(r.bytes());
+        ids.resize(chunks[chunk].rows);
+        for (uint32_t &id : ids) {
+            id = (uint32_t)r.varint();
+            if (id >= dict.size()) return false;
+        }
+        return r.ok;
+    }
+
+private:
+    int fd = -1;
+    mutable mutex starts_mu;
+    mutable map<size_t, vector<bool>> starts_cache; // chunk -> series boundaries
+
+    // Series boundaries of a chunk, from its pid and starttime columns; the
+    // Gorilla-coded columns restart their coder state there.
+    const vector<bool> *series_starts(size_t chunk) const {
+        {
+            lock_guard<mutex> lock(starts_mu);
+            auto it = starts_cache.find(chunk);
+            if (it != starts_cache.end()) return &it->second;
+        }
+        vector<int64_t> pid, start;
+        if (!read_ints(chunk, column("pid"), pid) || !read_ints(chunk, column("starttime"), start)) return nullptr;
+        vector<bool> starts(pid.size());
+        for (size_t i = 0; i < pid.size(); ++i)
+            starts[i] = i == 0 || pid[i] != pid[i - 1] || start[i] != start[i - 1];
+        lock_guard<mutex> lock(starts_mu);
+        return &(starts_cache[chunk] = move(starts)); // std::map: references stay valid
+    }
+
+    const ColumnChunk *fetch(size_t chunk, int col, string &raw) const {
+        if (chunk >= chunks.size() || col < 0 || (size_t)col >= columns.size()) return nullptr;
+        const ColumnChunk &cc = chunks[chunk].cols[col];
+        raw.resize(cc.size);
+        if (cc.size && pread(fd, &raw[0], cc.size, cc.offset) != (ssize_t)cc.size) return nullptr;
+        return &cc;
+    }
+};
+
+// sysmon record FILE [--interval MS] [--count N] [--rollup FILE.smx]
+// FILE "-" keeps only the rollups.
+int run_record(int argc, char **argv) {
+    const char *usage = "usage: sysmon record FILE|- [--interval MS] [--count N] [--rollup FILE.smx]\n";
+    if (argc < 1) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+    int interval_ms = REFRESH_INTERVAL * 1000;
+    long count = -1;
+    const char *rollup_path = nullptr;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--interval") == 0) interval_ms = max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--count") == 0) count = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "--rollup") == 0) rollup_path = argv[i + 1];
+        else break;
+    }
+    if (i < argc) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+    Recorder rec;
+    if (strcmp(argv[0], "-") != 0 && !rec.open(argv[0])) {
+        fprintf(stderr, "cannot open %s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    RollupStore rollups;
+    string err;
+    if (rollup_path && !rollups.open(rollup_path, true, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    Pipeline pipeline;
+    if (rec.is_open()) pipeline.add_stage([&](Sample &s, uint64_t ts) { rec.append(s, ts); });
+    if (rollup_path) {
+        pipeline.add_stage([&](Sample &s, uint64_t ts) {
+            double v[ROLLUP_SERIES];
+            rollup_values(s, v);
+            rollups.add(ts, v);
+        });
+    }
+    // two ticks in flight at most: a tick's /proc reads overlap the previous
+    // tick's writes, each tick with its own arena
+    TickArena arenas[2];
+    optional<Sample> samples[2];
+    for (long n = 0; count < 0 || n < count; ++n) {
+        usleep(interval_ms * 1000);
+        pipeline.drain(1);
+        samples[n % 2].reset();
+        arenas[n % 2].reset();
+        pipeline.start(samples[n % 2].emplace(arenas[n % 2].resource()), arenas[n % 2].resource());
+    }
+    pipeline.drain();
+    return 0;
+}
+
+// sysmon rollup FILE.smx [--from MS] [--to MS] [--points N] [--format text|csv]:
+// reads the finest tier that still holds the range in at most N buckets.
+int run_rollup(int argc, char **argv) {
+    const char *usage = "usage: sysmon rollup FILE.smx [--from MS] [--to MS] [--points N] [--format text|csv]\n";
+    if (argc < 1) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+    uint64_t now = unix_ms(), to = now, from = 0;
+    size_t points = 1000;
+    bool csv = false;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+        if (strcmp(argv[i], "--from") == 0) from = strtoull(argv[i + 1], nullptr, 10);
+        else if (strcmp(argv[i], "--to") == 0) to = strtoull(argv[i + 1], nullptr, 10);
+        else if (strcmp(argv[i], "--points") == 0) points = (size_t)max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--format") == 0) csv = strcmp(argv[i + 1], "csv") == 0;
+        else {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+    }
+    if (from == 0) from = to > 3600000 ? to - 3600000 : 0; // last hour
+
+    RollupStore store;
+    string err;
+    if (!store.open(argv[0], false, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    size_t tier = size(rollup_tiers) - 1;
+    for (size_t t = 0; t < size(rollup_tiers); ++t) {
+        uint64_t res_ms = rollup_tiers[t].resolution_s * 1000ull;
+        bool retained = now < from || now - from <= res_ms * rollup_tiers[t].buckets;
+        if (retained && (to - from) / res_ms + 1 <= points) {
+            tier = t;
+            break;
+        }
+    }
+    vector<RollupBucket> buckets;
+    if (!store.read_range(tier, from, to, buckets)) {
+        fprintf(stderr, "%s: short read\n", argv[0]);
+        return 1;
+    }
+    fprintf(stderr, "tier %us x %u: %zu buckets\n", rollup_tiers[tier].resolution_s, rollup_tiers[tier].buckets,
+            buckets.size());
+
+    string out;
+    if (csv) {
+        out += "start_ms,samples";
+        for (const char *name : rollup_series) {
+            for (const char *agg : {"_min", "_avg", "_max"}) {
+                out += ',';
+                out += name;
+                out += agg;
+            }
+        }
+        out += '\n';
+    } else {
+        char line[160];
+        snprintf(line, sizeof line, "%-19s %5s %19s %29s %7s %7s %7s\n", "TIME", "N", "CPU% MIN/AVG/MAX",
+                 "MEM USED kB MIN/AVG/MAX", "PROCS", "RUN^", "BLK^");
+        out += line;
+    }
+    for (const RollupBucket &b : buckets) {
+        if (csv) {
+            append_number(out, b.start_ms);
+            out += ',';
+            append_number(out, b.count);
+            for (size_t i = 0; i < ROLLUP_SERIES; ++i) {
+                for (double v : {b.min[i], b.avg(i), b.max[i]}) {
+                    out += ',';
+                    append_fixed2(out, v);
+                }
+            }
+            out += '\n';
+            continue;
+        }
+        char when[32], line[200];
+        time_t secs = (time_t)(b.start_ms / 1000);
+        struct tm tm;
+        strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", localtime_r(&secs, &tm));
+        snprintf(line, sizeof line, "%-19s %5u %5.1f/%5.1f/%5.1f %9.0f/%9.0f/%9.0f %7.1f %7.0f %7.0f\n", when, b.count,
+                 b.min[0], b.avg(0), b.max[0], b.min[1], b.avg(1), b.max[1], b.avg(2), b.max[3], b.max[4]);
+        out += line;
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
+
+// sysmon export-columnar IN OUT [--chunk-rows N]
+int run_export_columnar(int argc, char **argv) {
+    bool chunk_option = argc == 4 && strcmp(argv[2], "--chunk-rows") == 0;
+    if (argc != 2 && !chunk_option) {
+        fprintf(stderr, "usage: sysmon export-columnar IN.smr OUT.smc [--chunk-rows N]\n");
+        return 2;
+    }
+    size_t chunk_rows = 65536;
+    if (chunk_option) chunk_rows = (size_t)max(1, atoi(argv[3]));
+    RecordingReader in;
+    string err;
+    if (!in.open(argv[0], err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    ColumnarWriter out(chunk_rows);
+    if (!out.open(argv[1])) {
+        fprintf(stderr, "cannot create %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    RecordedSample s;
+    size_t samples = 0;
+    while (in.next(s)) {
+        out.add(s);
+        ++samples;
+    }
+    if (!out.finish()) {
+        fprintf(stderr, "error writing %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(stderr, "%zu samples -> %zu chunks, %llu bytes\n", samples, out.chunks(),
+            (unsigned long long)out.bytes_written());
+    return 0;
+}
+
+// sysmon dump-columnar FILE [col,col,...]: CSV of the selected columns; only
+// those column chunks are read.
+int run_dump_columnar(int argc, char **argv) {
+    if (argc < 1) {
+        fprintf(stderr, "usage: sysmon dump-columnar FILE [col,col,...]\n");
+        return 2;
+    }
+    ColumnarReader in;
+    string err;
+    if (!in.open(argv[0], err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    vector<int> sel;
+    if (argc >= 2) {
+        stringstream ss(argv[1]);
+        string name;
+        while (getline(ss, name, ',')) {
+            int c = in.column(name);
+            if (c < 0) {
+                fprintf(stderr, "no column %s\n", name.c_str());
+                return 1;
+            }
+            sel.push_back(c);
+        }
+    } else {
+        for (size_t c = 0; c < in.columns.size(); ++c) sel.push_back((int)c);
+    }
+
+    string out;
+    for (size_t i = 0; i < sel.size(); ++i) {
+        if (i) out += ',';
+        out += in.columns[sel[i]].name;
+    }
+    out += '\n';
+    vector<vector<int64_t>> ints(sel.size());
+    vector<vector<double>> floats(sel.size());
+    vector<vector<string>> dicts(sel.size());
+    vector<vector<uint32_t>> ids(sel.size());
+    for (size_t ch = 0; ch < in.chunks.size(); ++ch) {
+        for (size_t i = 0; i < sel.size(); ++i) {
+            bool ok = false;
+            switch (in.columns[sel[i]].type) {
+            case ColType::Int: ok = in.read_ints(ch, sel[i], ints[i]); break;
+            case ColType::Float: ok = in.read_floats(ch, sel[i], floats[i]); break;
+            case ColType::String: ok = in.read_strings(ch, sel[i], dicts[i], ids[i]); break;
+            }
+            if (!ok) {
+                fprintf(stderr, "corrupt chunk %zu column %s\n", ch, in.columns[sel[i]].name.c_str());
+                return 1;
+            }
+        }
+        for (size_t row = 0; row < in.chunks[ch].rows; ++row) {
+            for (size_t i = 0; i < sel.size(); ++i) {
+                if (i) out += ',';
+                switch (in.columns[sel[i]].type) {
+                case ColType::Int: append_number(out, ints[i][row]); break;
+                case ColType::Float: append_fixed2(out, floats[i][row]); break;
+                case ColType::String: append_csv_field(out, dicts[i][ids[i][row]]); break;
+                }
+            }
+            out += '\n';
+            if (out.size() > (1 << 16)) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
+
+// Options shared by the query subcommands.
+struct QueryOptions {
+    int64_t from = INT64_MIN, to = INT64_MAX; // ts_ms window, inclusive
+    size_t k = 10;
+    unsigned threads = 0; // 0 = one per CPU
+    int64_t pid = -1;
+};
+
+// Whether a chunk can contain rows for the query, judged from the footer
+// index alone: ts_ms window, and for per-PID queries the pid range. Not the
+// state range: dstate needs the non-D samples too, to end its ranges.
+static bool chunk_may_match(const ColumnarReader &in, size_t ch, const QueryOptions &q) {
+    const auto &cols = in.chunks[ch].cols;
+    int ts = in.column("ts_ms"), pid = in.column("pid");
+    if (in.chunks[ch].rows == 0) return false;
+    if (cols[ts].max_int() < q.from || cols[ts].min_int() > q.to) return false;
+    if (q.pid >= 0 && (cols[pid].max_int() < q.pid || cols[pid].min_int() > q.pid)) return false;
+    return true;
+}
+
+// Runs fn(thread_index, chunk) over the chunks on `threads` threads. Chunks
+// are handed out through a shared counter, so one slow chunk does not hold
+// back a whole thread's share.
+template <typename Fn>
+static void parallel_chunks(const vector<size_t> &todo, unsigned threads, Fn fn) {
+    atomic<size_t> next{0};
+    auto worker = [&](unsigned t) {
+        for (size_t i; (i = next++) < todo.size();) fn(t, todo[i]);
+    };
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (thread &th : pool) th.join();
+}
+
+// Top-K processes by average %CPU over the window.
+static bool query_top_cpu(const ColumnarReader &in, const vector<size_t> &todo, const QueryOptions &q, unsigned threads) {
+    struct Acc {
+        double sum = 0;
+        uint64_t n = 0;
+        string cmd;
+    };
+    using Key = pair<int64_t, int64_t>; // pid, starttime
+    vector<map<Key, Acc>> part(threads);
+    atomic<bool> failed{false};
+    int c_ts = in.column("ts_ms"), c_pid = in.column("pid"), c_start = in.column("starttime");
+    int c_cpu = in.column("cpu_percent"), c_cmd = in.column("cmd");
+    parallel_chunks(todo, threads, [&](unsigned t, size_t ch) {
+        vector<int64_t> ts, pid, start;
+        vector<double> cpu;
+        vector<string> dict;
+        vector<uint32_t> cmd;
+        if (!in.read_ints(ch, c_ts, ts) || !in.read_ints(ch, c_pid, pid) || !in.read_ints(ch, c_start, start) ||
+            !in.read_floats(ch, c_cpu, cpu) || !in.read_strings(ch, c_cmd, dict, cmd)) {
+            failed = true;
+            return;
+        }
+        for (size_t i = 0; i < ts.size(); ++i) {
+            if (ts[i] < q.from || ts[i] > q.to) continue;
+            Acc &a = part[t][{pid[i], start[i]}];
+            if (a.n == 0) a.cmd = dict[cmd[i]];
+            a.sum += cpu[i];
+            ++a.n;
+        }
+    });
+    if (failed) return false;
+    for (unsigned t = 1; t < threads; ++t) {
+        for (auto &kv : part[t]) {
+            Acc &a = part[0][kv.first];
+            if (a.n == 0) a.cmd = move(kv.second.cmd);
+            a.sum += kv.second.sum;
+            a.n += kv.second.n;
+        }
+    }
+    vector<pair<double, const pair<const Key, Acc> *>> ranked;
+    for (const auto &kv : part[0]) ranked.push_back({kv.second.sum / kv.second.n, &kv});
+    size_t k = min(q.k, ranked.size());
+    partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(),
+                 [](const auto &a, const auto &b) { return a.first > b.first; });
+    printf("%-7s %8s %8s  %s\n", "PID", "AVG_CPU", "SAMPLES", "CMD");
+    for (size_t i = 0; i < k; ++i) {
+        const auto &kv = *ranked[i].second;
+        printf("%-7lld %8.2f %8llu  %s\n", (long long)kv.first.first, ranked[i].first,
+               (unsigned long long)kv.second.n, kv.second.cmd.c_str());
+    }
+    return true;
+}
+
+// Peak RSS per command line over the window, largest first.
+static bool query_peak_rss(const ColumnarReader &in, const vector<size_t> &todo, const QueryOptions &q, unsigned threads) {
+    struct Peak {
+        int64_t rss = -1, pid = 0, ts = 0;
+    };
+    vector<unordered_map<string, Peak>> part(threads);
+    atomic<bool> failed{false};
+    int c_ts = in.column("ts_ms"), c_pid = in.column("pid"), c_rss = in.column("rss_kb"), c_cmd = in.column("cmd");
+    parallel_chunks(todo, threads, [&](unsigned t, size_t ch) {
+        vector<int64_t> ts, pid, rss;
+        vector<string> dict;
+        vector<uint32_t> cmd;
+        if (!in.read_ints(ch, c_ts, ts) || !in.read_ints(ch, c_pid, pid) || !in.read_ints(ch, c_rss, rss) ||
+            !in.read_strings(ch, c_cmd, dict, cmd)) {
+            failed = true;
+            return;
+        }
+        // reduce by dictionary id first, strings are only touched once per chunk
+        vector<Peak> by_id(dict.size());
+        for (size_t i = 0; i < ts.size(); ++i) {
+            if (ts[i] < q.from || ts[i] > q.to || rss[i] <= by_id[cmd[i]].rss) continue;
+            by_id[cmd[i]] = {rss[i], pid[i], ts[i]};
+        }
+        for (size_t id = 0; id < dict.size(); ++id) {
+            if (by_id[id].rss < 0) continue;
+            Peak &p = part[t][dict[id]];
+            if (by_id[id].rss > p.rss) p = by_id[id];
+        }
+    });
+    if (failed) return false;
+    for (unsigned t = 1; t < threads; ++t) {
+        for (auto &kv : part[t]) {
+            Peak &p = part[0][kv.first];
+            if (kv.second.rss > p.rss) p = kv.second;
+        }
+    }
+    vector<const pair<const string, Peak> *> ranked;
+    for (const auto &kv : part[0]) ranked.push_back(&kv);
+    size_t k = min(q.k, ranked.size());
+    partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(),
+                 [](const auto *a, const auto *b) { return a->second.rss > b->second.rss; });
+    printf("%10s %-7s %-14s  %s\n", "PEAK_RSS", "PID", "TS_MS", "CMD");
+    for (size_t i = 0; i < k; ++i)
+        printf("%10lld %-7lld %-14lld  %s\n", (long long)ranked[i]->second.rss, (long long)ranked[i]->second.pid,
+               (long long)ranked[i]->second.ts, ranked[i]->first.c_str());
+    return true;
+}
+
+// Time ranges in which one PID was sampled in D (uninterruptible) state. A
+// range ends at a sample out of D, when the PID names another process
+// (starttime changed), or at a gap in the samples: the process was not seen
+// in between, so it cannot be said to have stayed in D.
+static bool query_dstate(const ColumnarReader &in, const vector<size_t> &todo, const QueryOptions &q, unsigned threads) {
+    struct Row {
+        int64_t starttime, ts;
+        bool in_d;
+        bool operator<(const Row &o) const { return tie(starttime, ts) < tie(o.starttime, o.ts); }
+    };
+    vector<vector<Row>> part(threads);
+    atomic<bool> failed{false};
+    int c_ts = in.column("ts_ms"), c_pid = in.column("pid"), c_state = in.column("state");
+    int c_start = in.column("starttime");
+    parallel_chunks(todo, threads, [&](unsigned t, size_t ch) {
+        vector<int64_t> ts, pid, state, start;
+        if (!in.read_ints(ch, c_pid, pid)) {
+            failed = true;
+            return;
+        }
+        // rows are grouped by pid, so the target's rows are one contiguous run
+        auto lo = lower_bound(pid.begin(), pid.end(), q.pid), hi = upper_bound(lo, pid.end(), q.pid);
+        if (lo == hi) return;
+        if (!in.read_ints(ch, c_ts, ts) || !in.read_ints(ch, c_state, state) || !in.read_ints(ch, c_start, start)) {
+            failed = true;
+            return;
+        }
+        for (size_t i = lo - pid.begin(); i < (size_t)(hi - pid.begin()); ++i)
+            if (ts[i] >= q.from && ts[i] <= q.to) part[t].push_back({start[i], ts[i], state[i] == 'D'});
+    });
+    if (failed) return false;
+    vector<Row> rows;
+    for (auto &p : part) rows.insert(rows.end(), p.begin(), p.end());
+    sort(rows.begin(), rows.end());
+    // sample interval: the median step between consecutive samples of one process
+    vector<int64_t> steps;
+    for (size_t i = 1; i < rows.size(); ++i)
+        if (rows[i].starttime == rows[i - 1].starttime) steps.push_back(rows[i].ts - rows[i - 1].ts);
+    int64_t max_step = INT64_MAX;
+    if (!steps.empty()) {
+        nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+        max_step = steps[steps.size() / 2] * 3 / 2;
+    }
+    auto continues = [&](size_t j) { // rows[j + 1] extends a D range ending at rows[j]
+        return rows[j + 1].in_d && rows[j + 1].starttime == rows[j].starttime && rows[j + 1].ts - rows[j].ts <= max_step;
+    };
+    printf("%-14s %-14s %10s %8s  %s\n", "FROM_MS", "TO_MS", "DURATION", "SAMPLES", "STARTTIME");
+    size_t ranges = 0, incarnations = 0;
+    for (size_t i = 0; i < rows.size(); ++i)
+        incarnations += i == 0 || rows[i].starttime != rows[i - 1].starttime;
+    for (size_t i = 0; i < rows.size();) {
+        if (!rows[i].in_d) { ++i; continue; }
+        size_t j = i;
+        while (j + 1 < rows.size() && continues(j)) ++j;
+        printf("%-14lld %-14lld %9.3fs %8zu  %lld\n", (long long)rows[i].ts, (long long)rows[j].ts,
+               (rows[j].ts - rows[i].ts) / 1000.0, j - i + 1, (long long)rows[i].starttime);
+        ++ranges;
+        i = j + 1;
+    }
+    fprintf(stderr, "pid %lld: %zu samples of %zu process(es), %zu D-state ranges\n", (long long)q.pid, rows.size(),
+            incarnations, ranges);
+    return true;
+}
+
+// sysmon query FILE.smc top-cpu|peak-rss|dstate PID [--from MS] [--to MS] [-k N] [--threads N]
+int run_query(int argc, char **argv) {
+    const char *usage = "usage: sysmon query FILE.smc top-cpu|peak-rss|dstate PID [--from MS] [--to MS] [-k N] [--threads N]\n";
+    if (argc < 2) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+    string what = argv[1];
+    QueryOptions q;
+    int i = 2;
+    if (what == "dstate") {
+        if (argc < 3 || !is_number(argv[2])) {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+        q.pid = atoll(argv[i++]);
+    } else if (what != "top-cpu" && what != "peak-rss") {
+        fprintf(stderr, "unknown query: %s\n%s", what.c_str(), usage);
+        return 2;
+    }
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--from") == 0) q.from = atoll(argv[i + 1]);
+        else if (strcmp(argv[i], "--to") == 0) q.to = atoll(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) q.k = (size_t)max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--threads") == 0) q.threads = (unsigned)max(1, atoi(argv[i + 1]));
+        else break;
+    }
+    if (i < argc) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+
+    ColumnarReader in;
+    string err;
+    if (!in.open(argv[0], err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    for (const ColumnDef &c : columnar_schema) {
+        if (in.column(c.name) < 0) {
+            fprintf(stderr, "%s: missing column %s\n", argv[0], c.name);
+            return 1;
+        }
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    vector<size_t> todo;
+    for (size_t ch = 0; ch < in.chunks.size(); ++ch)
+        if (chunk_may_match(in, ch, q)) todo.push_back(ch);
+    unsigned threads = q.threads ? q.threads : max(1u, thread::hardware_concurrency());
+    threads = (unsigned)max<size_t>(1, min<size_t>(threads, todo.size()));
+
+    bool ok = what == "top-cpu" ? query_top_cpu(in, todo, q, threads)
+            : what == "peak-rss" ? query_peak_rss(in, todo, q, threads)
+                                 : query_dstate(in, todo, q, threads);
+    if (!ok) {
+        fprintf(stderr, "%s: corrupt column chunk\n", argv[0]);
+        return 1;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+    fprintf(stderr, "scanned %zu of %zu chunks (%zu skipped by index) on %u threads in %.1f ms\n", todo.size(),
+            in.chunks.size(), in.chunks.size() - todo.size(), threads, ms);
+    return 0;
+}
+
+// ---- snapshot diff ----
+
+// Copies a live sample into the recorded form (names resolved), reusing the
+// storage of out so a ring of these settles into not allocating.
+void to_recorded(const Sample &s, uint64_t ts_ms, RecordedSample &out) {
+    out.ts_ms = ts_ms;
+    out.cpu_usage = s.cpu_usage;
+    out.mem_total = s.mem_total;
+    out.mem_used = s.mem_used;
+    out.rows.resize(s.procs.size());
+    for (size_t i = 0; i < s.procs.size(); ++i) {
+        const ProcSnapshot &p = s.procs[i];
+        RecordedRow &r = out.rows[i];
+        r.pid = p.pid;
+        r.starttime = p.starttime;
+        r.state = p.state;
+        r.cpu_time = p.total_time();
+        r.rss_kb = p.rss;
+        r.io_read = p.io_read;
+        r.io_write = p.io_write;
+        r.cpu_percent = p.cpu_percent;
+        r.mem_percent = p.mem_percent;
+        r.user.assign(strings.str(p.user));
+        r.unit.assign(strings.str(p.unit));
+        r.cmd.assign(strings.str(p.cmd));
+    }
+}
+
+// The most recent samples of the TUI, oldest overwritten first.
+class History {
+public:
+    explicit History(size_t capacity) : ring(capacity) {}
+
+    void push(const Sample &s, uint64_t ts_ms) {
+        to_recorded(s, ts_ms, ring[head]);
+        head = (head + 1) % ring.size();
+        count = min(count + 1, ring.size());
+    }
+    size_t size() const { return count; }
+    // age 0 is the newest sample, size() - 1 the oldest
+    const RecordedSample &at(size_t age) const { return ring[(head + ring.size() - 1 - age) % ring.size()]; }
+
+private:
+    vector<RecordedSample> ring;
+    size_t head = 0, count = 0;
+};
+
+static const size_t HISTORY_SAMPLES = 90; // 3 minutes at the default refresh
+
+// Change of one process between two samples; a is null if it appeared in
+// between, b if it disappeared.
+struct ProcDelta {
+    const RecordedRow *a = nullptr, *b = nullptr;
+    int64_t cpu_ticks = 0; // CPU time consumed in between
+    int64_t rss_kb = 0, io_read = 0, io_write = 0;
+    const RecordedRow &row() const { return b ? *b : *a; }
+};
+
+// Totals of one unit or user: process counts at both instants and the sums
+// of their process deltas.
+struct GroupDelta {
+    string name;
+    int procs_a = 0, procs_b = 0;
+    int64_t cpu_ticks = 0, rss_kb = 0, io_read = 0, io_write = 0;
+};
+
+struct SnapshotDiff {
+    double seconds = 0;
+    size_t appeared = 0, disappeared = 0, unchanged = 0;
+    vector<ProcDelta> procs; // changed processes, largest CPU consumers first
+    vector<GroupDelta> units, users;
+};
+
+// Diffs two samples by merge-joining their rows on (pid, starttime), so a
+// reused PID counts as one process gone and another appeared. The result
+// points into a and b.
+SnapshotDiff diff_samples(const RecordedSample &a, const RecordedSample &b) {
+    auto sorted = [](const RecordedSample &s) {
+        vector<const RecordedRow *> v;
+        v.reserve(s.rows.size());
+        for (const RecordedRow &r : s.rows) v.push_back(&r);
+        sort(v.begin(), v.end(), [](const RecordedRow *x, const RecordedRow *y) {
+            return tie(x->pid, x->starttime) < tie(y->pid, y->starttime);
+        });
+        return v;
+    };
+    vector<const RecordedRow *> ra = sorted(a), rb = sorted(b);
+
+    SnapshotDiff d;
+    d.seconds = ((double)b.ts_ms - (double)a.ts_ms) / 1000.0;
+    map<string, GroupDelta> units, users;
+    size_t i = 0, j = 0;
+    while (i < ra.size() || j < rb.size()) {
+        ProcDelta p;
+        if (j == rb.size() || (i < ra.size() && tie(ra[i]->pid, ra[i]->starttime) < tie(rb[j]->pid, rb[j]->starttime)))
+            p.a = ra[i++];
+        else if (i == ra.size() || tie(rb[j]->pid, rb[j]->starttime) < tie(ra[i]->pid, ra[i]->starttime))
+            p.b = rb[j++];
+        else {
+            p.a = ra[i++];
+            p.b = rb[j++];
+        }
+        // a new process consumed all of its counters after the first instant;
+        // for a vanished one only the RSS it released is known
+        auto delta = [](uint64_t before, uint64_t after) { return (int64_t)after - (int64_t)before; };
+        if (p.b) {
+            p.cpu_ticks = delta(p.a ? p.a->cpu_time : 0, p.b->cpu_time);
+            p.io_read = delta(p.a ? p.a->io_read : 0, p.b->io_read);
+            p.io_write = delta(p.a ? p.a->io_write : 0, p.b->io_write);
+        }
+        p.rss_kb = delta(p.a ? p.a->rss_kb : 0, p.b ? p.b->rss_kb : 0);
+
+        for (GroupDelta *g : {&units[p.row().unit], &users[p.row().user]}) {
+            g->procs_a += p.a != nullptr;
+            g->procs_b += p.b != nullptr;
+            g->cpu_ticks += p.cpu_ticks;
+            g->rss_kb += p.rss_kb;
+            g->io_read += p.io_read;
+            g->io_write += p.io_write;
+        }
+        if (!p.a) ++d.appeared;
+        else if (!p.b) ++d.disappeared;
+        if (p.a && p.b && !p.cpu_ticks && !p.rss_kb && !p.io_read && !p.io_write) ++d.unchanged;
+        else d.procs.push_back(p);
+    }
+    sort(d.procs.begin(), d.procs.end(), [](const ProcDelta &x, const ProcDelta &y) {
+        if (x.cpu_ticks != y.cpu_ticks) return x.cpu_ticks > y.cpu_ticks;
+        return llabs(x.rss_kb) > llabs(y.rss_kb);
+    });
+    for (auto *src : {&units, &users}) {
+        vector<GroupDelta> &dst = src == &units ? d.units : d.users;
+        for (auto &kv : *src) {
+            kv.second.name = kv.first.empty() ? "-" : kv.first;
+            dst.push_back(move(kv.second));
+        }
+        sort(dst.begin(), dst.end(), [](const GroupDelta &x, const GroupDelta &y) { return x.cpu_ticks > y.cpu_ticks; });
+    }
+    return d;
+}
+
+// Text report of a diff, one string per line; at most `limit` process rows (0 = all).
+void format_diff(const SnapshotDiff &d, vector<string> &lines, size_t limit) {
+    lines.clear();
+    char buf[256];
+    auto cpu_s = [](int64_t ticks) { return (double)ticks / (double)Hertz; };
+    auto cpu_pct = [&](int64_t ticks) { return d.seconds > 0 ? 100.0 * cpu_s(ticks) / d.seconds : 0.0; };
+    snprintf(buf, sizeof buf, "Diff over %.1f s: %zu appeared, %zu disappeared, %zu changed, %zu unchanged",
+             d.seconds, d.appeared, d.disappeared, d.procs.size() - d.appeared - d.disappeared, d.unchanged);
+    lines.push_back(buf);
+    for (const auto *groups : {&d.units, &d.users}) {
+        lines.emplace_back();
+        snprintf(buf, sizeof buf, "%-24s %11s %9s %7s %11s %10s %10s", groups == &d.units ? "UNIT" : "USER",
+                 "PROCS", "CPU(s)", "%CPU", "RSS(kB)", "READ(kB)", "WRITE(kB)");
+        lines.push_back(buf);
+        for (const GroupDelta &g : *groups) {
+            char procs[24];
+            snprintf(procs, sizeof procs, "%d->%d", g.procs_a, g.procs_b);
+            snprintf(buf, sizeof buf, "%-24.24s %11s %9.2f %7.2f %+11lld %10lld %10lld", g.name.c_str(), procs,
+                     cpu_s(g.cpu_ticks), cpu_pct(g.cpu_ticks), (long long)g.rss_kb, (long long)g.io_read / 1024,
+                     (long long)g.io_write / 1024);
+            lines.push_back(buf);
+        }
+    }
+    lines.emplace_back();
+    snprintf(buf, sizeof buf, " %-7s %-10s %9s %7s %11s %10s %10s  %s", "PID", "USER", "CPU(s)", "%CPU", "RSS(kB)",
+             "READ(kB)", "WRITE(kB)", "CMD");
+    lines.push_back(buf);
+    size_t n = limit ? min(limit, d.procs.size()) : d.procs.size();
+    for (size_t i = 0; i < n; ++i) {
+        const ProcDelta &p = d.procs[i];
+        const RecordedRow &r = p.row();
+        snprintf(buf, sizeof buf, "%c%-7lld %-10.10s %9.2f %7.2f %+11lld %10lld %10lld  %.60s",
+                 !p.a ? '+' : !p.b ? '-' : ' ', (long long)r.pid, r.user.c_str(), cpu_s(p.cpu_ticks),
+                 cpu_pct(p.cpu_ticks), (long long)p.rss_kb, (long long)p.io_read / 1024,
+                 (long long)p.io_write / 1024, r.cmd.c_str());
+        lines.push_back(buf);
+    }
+}
+
+// Screen of the TUI showing a text report instead of the table: a title, the
+// lines (scrolled) and a key help line.
+void draw_report_frame(Renderer &r, const char *title, const vector<string> &lines, size_t &scroll, const char *help) {
+    r.begin_frame();
+    int rows = r.rows();
+    int max_rows = max(rows - 4, 1);
+    scroll = min(scroll, lines.size() > (size_t)max_rows ? lines.size() - max_rows : 0);
+    r.put(0, 0, title, true);
+    for (int i = 0; i < max_rows && scroll + i < lines.size(); ++i) r.put(i + 1, 0, lines[scroll + i]);
+    r.put(rows - 2, 0, help);
+    r.end_frame();
+}
+
+// Diff screen of the TUI: the report of format_diff.
+void draw_diff_frame(Renderer &r, const vector<string> &lines, size_t &scroll, const string &base) {
+    char title[128];
+    snprintf(title, sizeof title, "SysMon - diff   Base: %s   Now: latest sample", base.c_str());
+    draw_report_frame(r, title, lines, scroll,
+                      "Diff: (m) mark now as base  (<,>) older/newer base  (arrows) scroll  (d) back  (q) quit");
+}
+
+// sysmon diff FILE.smr [FROM_MS [TO_MS]] [-n N]: diff of the last sample at or
+// before FROM_MS (default: the first sample) and the last one at or before
+// TO_MS (default: the last sample).
+int run_diff(int argc, char **argv) {
+    if (argc < 1) {
+        fprintf(stderr, "usage: sysmon diff FILE.smr [FROM_MS [TO_MS]] [-n N]\n");
+        return 2;
+    }
+    uint64_t from = 0, to = UINT64_MAX;
+    size_t limit = 0;
+    int pos = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) limit = (size_t)max(0, atoi(argv[++i]));
+        else if (is_number(argv[i]) && pos == 0) { from = strtoull(argv[i], nullptr, 10); ++pos; }
+        else if (is_number(argv[i]) && pos == 1) { to = strtoull(argv[i], nullptr, 10); ++pos; }
+        else {
+            fprintf(stderr, "usage: sysmon diff FILE.smr [FROM_MS [TO_MS]] [-n N]\n");
+            return 2;
+        }
+    }
+    RecordingReader in;
+    string err;
+    if (!in.open(argv[0], err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    RecordedSample a, b, cur;
+    bool has_a = false, has_b = false;
+    while (in.next(cur) && cur.ts_ms <= to) {
+        if (!has_a || cur.ts_ms <= from) { swap(a, cur); has_a = true; }
+        else { swap(b, cur); has_b = true; }
+    }
+    if (!has_b) {
+        fprintf(stderr, "%s: need two samples in the range\n", argv[0]);
+        return 1;
+    }
+    vector<string> lines;
+    format_diff(diff_samples(a, b), lines, limit);
+    printf("%llu -> %llu\n", (unsigned long long)a.ts_ms, (unsigned long long)b.ts_ms);
+    for (const string &l : lines) printf("%s\n", l.c_str());
+    return 0;
+}
+
+// ---- NUMA view ----
+
+static const size_t NUMA_PROCS = 12;        // processes placed, from the table's first visible row
+static const uint64_t NUMA_MAPS_MS = 10000; // numa_maps of a process is read at most this often
+
+// State of the NUMA screen ('n'): node memory and numastat rates, sampled with
+// every refresh while the screen is up, and where the pages and threads of the
+// processes at the top of the table are. numa_maps walks a process's page
+// tables, so it is read only for those processes and at most every NUMA_MAPS_MS.
+class NumaMonitor {
+public:
+    // Samples the nodes and places the NUMA_PROCS rows from view.scroll on.
+    void update(const View &view, uint64_t ts_ms) {
+        prev.swap(nodes);
+        prev_ts = now_ts;
+        now_ts = ts_ms;
+        nodes = read_numa_nodes();
+        if (prev.size() != nodes.size()) prev.clear(); // node hotplug: no rates this time
+        vector<int> cpu_node = cpu_nodes(nodes);
+
+        shown.clear();
+        for (size_t i = view.scroll; i < view.rows.size() && shown.size() < NUMA_PROCS; ++i) {
+            const ProcSnapshot &p = *view.rows[i];
+            ProcPlacement &e = procs[p.pid];
+            if (e.starttime != p.starttime || ts_ms - e.read_ms >= NUMA_MAPS_MS) {
+                e.starttime = p.starttime;
+                e.read_ms = ts_ms;
+                e.ok = read_proc_numa(p.pid, cpu_node, e.usage);
+            }
+            e.user = strings.str(p.user);
+            e.cmd = strings.str(p.cmd);
+            e.rss = p.rss;
+            e.last_shown_ms = ts_ms;
+            shown.push_back(p.pid);
+        }
+        erase_if(procs, [&](const auto &kv) { return ts_ms - kv.second.last_shown_ms > 6 * NUMA_MAPS_MS; });
+    }
+
+    // Text of the screen, one string per line.
+    void format(vector<string> &lines) const {
+        lines.clear();
+        char buf[512];
+        if (nodes.empty()) {
+            lines.push_back("No NUMA nodes under /sys/devices/system/node (kernel without NUMA support).");
+            return;
+        }
+        double secs = prev.empty() ? 0.0 : ((double)now_ts - (double)prev_ts) / 1000.0;
+        snprintf(buf, sizeof buf, "%-5s %13s %13s %13s %6s %12s %12s %12s", "NODE", "MemTotal(kB)", "MemFree(kB)",
+                 "FilePages(kB)", "CPUs", "hit/s", "miss/s", "foreign/s");
+        lines.push_back(buf);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const NumaNode &n = nodes[i];
+            int len = snprintf(buf, sizeof buf, "N%-4d %13llu %13llu %13llu %6zu", n.id, n.mem_total, n.mem_free,
+                               n.file_pages, n.cpus.size());
+            if (secs > 0) {
+                const NumaNode &o = prev[i];
+                auto rate = [&](unsigned long long a, unsigned long long b) { return b >= a ? (double)(b - a) / secs : 0.0; };
+                snprintf(buf + len, sizeof buf - len, " %12.0f %12.0f %12.0f", rate(o.numa_hit, n.numa_hit),
+                         rate(o.numa_miss, n.numa_miss), rate(o.numa_foreign, n.numa_foreign));
+            } else {
+                snprintf(buf + len, sizeof buf - len, " %12s %12s %12s", "-", "-", "-");
+            }
+            lines.push_back(buf);
+        }
+        lines.push_back("(hit/miss/foreign: page allocations per second; miss = placed here though another node was");
+        lines.push_back(" preferred, foreign = meant for this node but placed elsewhere)");
+
+        lines.emplace_back();
+        string header = " PID     USER       RSS(kB)";
+        for (const NumaNode &n : nodes) {
+            snprintf(buf, sizeof buf, " %10s", ("N" + to_string(n.id) + "(kB)").c_str());
+            header += buf;
+        }
+        header += "  MEM ON    THREADS ON  CMD";
+        lines.push_back(header);
+        for (pid_t pid : shown) {
+            const ProcPlacement &e = procs.at(pid);
+            snprintf(buf, sizeof buf, "%c%-7d %-10.10s %8lu", e.remote() ? '!' : ' ', (int)pid, e.user.c_str(), e.rss);
+            string line = buf;
+            if (!e.ok) {
+                line += "  numa_maps not readable";
+            } else {
+                for (const NumaNode &n : nodes) {
+                    snprintf(buf, sizeof buf, " %10llu", (size_t)n.id < e.usage.node_kb.size() ? e.usage.node_kb[n.id] : 0ULL);
+                    line += buf;
+                }
+                int mem = e.mem_node(), run = e.thread_node();
+                char mem_on[16] = "-", run_on[16] = "-";
+                if (mem >= 0) snprintf(mem_on, sizeof mem_on, "N%d %.0f%%", mem, 100.0 * e.mem_share(mem));
+                if (run >= 0) snprintf(run_on, sizeof run_on, "N%d %u/%u", run, e.usage.node_threads[run], e.threads());
+                snprintf(buf, sizeof buf, "  %-9s %-11s", mem_on, run_on);
+                line += buf;
+            }
+            line += " ";
+            line += e.cmd.substr(0, 60);
+            lines.push_back(line);
+        }
+        if (!shown.empty())
+            lines.push_back("(! = most of the memory is on a node where fewer than half of the threads last ran)");
+    }
+
+private:
+    struct ProcPlacement {
+        unsigned long long starttime = 0;
+        uint64_t read_ms = 0, last_shown_ms = 0;
+        bool ok = false;
+        ProcNumaUsage usage;
+        string user, cmd;
+        unsigned long rss = 0;
+
+        unsigned long long total_kb() const { return accumulate(usage.node_kb.begin(), usage.node_kb.end(), 0ULL); }
+        unsigned threads() const { return accumulate(usage.node_threads.begin(), usage.node_threads.end(), 0u); }
+        double mem_share(int node) const {
+            unsigned long long total = total_kb();
+            return total ? (double)usage.node_kb[node] / (double)total : 0.0;
+        }
+        // Node holding the most pages, -1 if none.
+        int mem_node() const {
+            auto it = max_element(usage.node_kb.begin(), usage.node_kb.end());
+            return it == usage.node_kb.end() || *it == 0 ? -1 : (int)(it - usage.node_kb.begin());
+        }
+        // Node most threads last ran on, -1 if unknown.
+        int thread_node() const {
+            auto it = max_element(usage.node_threads.begin(), usage.node_threads.end());
+            return it == usage.node_threads.end() || *it == 0 ? -1 : (int)(it - usage.node_threads.begin());
+        }
+        // Over half of the memory on one node, and fewer than half of the threads there.
+        bool remote() const {
+            int mem = mem_node();
+            if (!ok || mem < 0 || mem_share(mem) <= 0.5 || threads() == 0) return false;
+            unsigned local = (size_t)mem < usage.node_threads.size() ? usage.node_threads[mem] : 0;
+            return 2 * local < threads();
+        }
+    };
+
+    vector<NumaNode> nodes, prev;
+    uint64_t now_ts = 0, prev_ts = 0;
+    unordered_map<pid_t, ProcPlacement> procs;
+    vector<pid_t> shown;
+};
+
+// NUMA screen of the TUI: the report of NumaMonitor::format.
+void draw_numa_frame(Renderer &r, const vector<string> &lines, size_t &scroll) {
+    char title[128];
+    snprintf(title, sizeof title, "SysMon - NUMA   Refresh: %ds   Processes: the first %zu rows of the table (sort with s)",
+             REFRESH_INTERVAL, NUMA_PROCS);
+    draw_report_frame(r, title, lines, scroll, "NUMA: (s) sort by CPU/MEM  (r) refresh  (arrows) scroll  (n) back  (q) quit");
+}
+
+// ---- huge page view ----
+
+// State of the huge page screen ('h'): THP settings and usage, the rates of
+// THP and compaction events from /proc/vmstat, and free memory by block size
+// from /proc/buddyinfo. Sampled with every refresh while the screen is up.
+class HugePageMonitor {
+public:
+    void update(uint64_t ts_ms) {
+        prev = cur;
+        prev_ts = now_ts;
+        have_prev = have_cur;
+        now_ts = ts_ms;
+        have_cur = read_vmstat(cur);
+        pmr::string meminfo;
+        if (read_file("/proc/meminfo", meminfo)) {
+            anon_kb = meminfo_value(meminfo, "AnonHugePages:");
+            shmem_kb = meminfo_value(meminfo, "ShmemHugePages:");
+            huge_page_kb = meminfo_value(meminfo, "Hugepagesize:");
+        }
+        zones = read_buddyinfo();
+        enabled = thp_setting("enabled");
+        defrag = thp_setting("defrag");
+    }
+
+    // Text of the screen, one string per line.
+    void format(vector<string> &lines) const {
+        lines.clear();
+        char buf[512];
+        snprintf(buf, sizeof buf, "THP enabled: %s   defrag: %s   AnonHugePages: %llu kB   ShmemHugePages: %llu kB",
+                 enabled.empty() ? "n/a" : enabled.c_str(), defrag.empty() ? "n/a" : defrag.c_str(), anon_kb, shmem_kb);
+        lines.push_back(buf);
+
+        lines.emplace_back();
+        snprintf(buf, sizeof buf, "%-20s %14s %10s", "EVENT", "TOTAL", "/s");
+        lines.push_back(buf);
+        static const struct {
+            const char *name;
+            unsigned long long VmStat::*value;
+            const char *meaning;
+        } events[] = {
+            {"thp_fault_alloc", &VmStat::thp_fault_alloc, "faults given a huge page"},
+            {"thp_fault_fallback", &VmStat::thp_fault_fallback, "faults that fell back to small pages"},
+            {"thp_collapse_alloc", &VmStat::thp_collapse_alloc, "huge pages assembled by khugepaged"},
+            {"thp_split_page", &VmStat::thp_split_page, "huge pages split up"},
+            {"compact_stall", &VmStat::compact_stall, "allocations that stalled in direct compaction"},
+            {"compact_fail", &VmStat::compact_fail, "direct compactions that found no free block"},
+            {"compact_success", &VmStat::compact_success, "direct compactions that did"},
+        };
+        double secs = have_prev && have_cur ? ((double)now_ts - (double)prev_ts) / 1000.0 : 0.0;
+        for (const auto &e : events) {
+            unsigned long long now = cur.*e.value, before = prev.*e.value;
+            char rate[24] = "-";
+            if (secs > 0) snprintf(rate, sizeof rate, "%.1f", now >= before ? (double)(now - before) / secs : 0.0);
+            snprintf(buf, sizeof buf, "%-20s %14llu %10s   %s", e.name, now, rate, e.meaning);
+            lines.push_back(buf);
+        }
+
+        lines.emplace_back();
+        if (zones.empty()) {
+            lines.push_back("/proc/buddyinfo not readable");
+            return;
+        }
+        // block size of each order; blocks of a huge page and up need no compaction to back one
+        static const unsigned long long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+        unsigned long long huge_kb = huge_page_kb ? huge_page_kb : 2048;
+        size_t orders = 0;
+        for (const BuddyZone &z : zones) orders = max(orders, z.free.size());
+        auto size_label = [](unsigned long long kb) {
+            char label[16];
+            if (kb >= 1024 * 1024) snprintf(label, sizeof label, "%lluG", kb / (1024 * 1024));
+            else if (kb >= 1024) snprintf(label, sizeof label, "%lluM", kb / 1024);
+            else snprintf(label, sizeof label, "%lluK", kb);
+            return string(label);
+        };
+        string header = "FREE BLOCKS    ";
+        for (size_t o = 0; o < orders; ++o) {
+            snprintf(buf, sizeof buf, " %7s", size_label(page_kb << o).c_str());
+            header += buf;
+        }
+        snprintf(buf, sizeof buf, "  >=%s free(kB)", size_label(huge_kb).c_str());
+        lines.push_back(header + buf);
+        for (const BuddyZone &z : zones) {
+            snprintf(buf, sizeof buf, "N%-3d %-10.10s", z.node, z.zone.c_str());
+            string line = buf;
+            unsigned long long huge_free = 0;
+            for (size_t o = 0; o < orders; ++o) {
+                unsigned long long n = o < z.free.size() ? z.free[o] : 0;
+                snprintf(buf, sizeof buf, " %7llu", n);
+                line += buf;
+                if ((page_kb << o) >= huge_kb) huge_free += n * (page_kb << o);
+            }
+            snprintf(buf, sizeof buf, "  %15llu", huge_free);
+            lines.push_back(line + buf);
+        }
+        lines.push_back("(few large blocks left while memory is free = fragmentation: huge page faults then");
+        lines.push_back(" compact memory first, or fall back to small pages)");
+    }
+
+private:
+    VmStat cur, prev;
+    bool have_cur = false, have_prev = false;
+    uint64_t now_ts = 0, prev_ts = 0;
+    unsigned long long anon_kb = 0, shmem_kb = 0, huge_page_kb = 0;
+    vector<BuddyZone> zones;
+    string enabled, defrag;
+};
+
+// Huge page screen of the TUI: the report of HugePageMonitor::format.
+void draw_huge_page_frame(Renderer &r, const vector<string> &lines, size_t &scroll) {
+    char title[64];
+    snprintf(title, sizeof title, "SysMon - huge pages   Refresh: %ds", REFRESH_INTERVAL);
+    draw_report_frame(r, title, lines, scroll, "Huge pages: (r) refresh  (arrows) scroll  (h) back  (q) quit");
+}
+
+// ---- OOM kills ----
+
+static const size_t OOM_LOG_SIZE = 100;
+static const unsigned long long OOM_UNIT_IDLE = 30; // samples a unit's cgroup is watched after its last process
+
+// One OOM kill and the victim as the last sample before the kill saw it.
+struct OomKill {
+    uint64_t ts_ms = 0;
+    RecordedRow victim; // pid 0 if no process could be matched
+    bool named = false; // victim named by the kernel log, else the largest process that vanished
+    string units;       // units whose cgroup counted the kill, "" if none did
+};
+
+// Notices OOM kills after each sample and keeps a log of them. The oom_kill
+// counter of /proc/vmstat counts every kill, host-wide or at a cgroup limit;
+// when it moves, the oom_kill counters in memory.events (cgroup v2, or
+// memory.oom_control of v1) tell which units hit their limit. The victim is the process a "Killed process" line of
+// /dev/kmsg names (readable as root), else the largest process by RSS that
+// vanished since the previous sample, preferring those units.
+class OomTracker {
+public:
+    OomTracker() {
+        kmsg = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (kmsg >= 0) lseek(kmsg, 0, SEEK_END); // only kills from now on
+    }
+    ~OomTracker() {
+        if (kmsg >= 0) close(kmsg);
+    }
+    OomTracker(const OomTracker &) = delete;
+    OomTracker &operator=(const OomTracker &) = delete;
+
+    // host_kills: Sample::oom_kills of cur; prev: the sample before cur, if any.
+    void update(unsigned long long host_kills, const RecordedSample *prev, const RecordedSample &cur) {
+        ++seq;
+        watch_units(cur);
+        unsigned long long counted = have_host && host_kills >= host_total ? host_kills - host_total : 0;
+        host_total = host_kills;
+        have_host = true;
+        vector<int64_t> named = read_kernel_log();
+        if (counted == 0 && named.empty()) return;
+
+        // which units' cgroups counted kills
+        string hit;
+        unordered_set<string> hit_units;
+        for (auto &kv : units) {
+            UnitWatch &w = kv.second;
+            if (w.path.empty()) continue;
+            unsigned long long kills = read_unit_kills(w.path);
+            if (kills > w.kills) {
+                hit += hit.empty() ? "" : " ";
+                hit += kv.first;
+                hit_units.insert(kv.first);
+            }
+            w.kills = kills;
+        }
+
+        // processes of prev that are gone or dying in cur, largest first,
+        // those of the units that hit their limit before the others
+        unordered_map<int64_t, const RecordedRow *> now;
+        for (const RecordedRow &r : cur.rows) now[r.pid] = &r;
+        vector<const RecordedRow *> vanished;
+        if (prev)
+            for (const RecordedRow &r : prev->rows) {
+                auto it = now.find(r.pid);
+                if (it == now.end() || it->second->starttime != r.starttime || it->second->state == 'Z')
+                    vanished.push_back(&r);
+            }
+        sort(vanished.begin(), vanished.end(), [&](const RecordedRow *a, const RecordedRow *b) {
+            bool ha = hit_units.count(a->unit), hb = hit_units.count(b->unit);
+            return ha != hb ? ha : a->rss_kb > b->rss_kb;
+        });
+
+        size_t n = max<size_t>(counted, named.size());
+        unordered_set<int64_t> logged;
+        for (size_t i = 0, next = 0; i < n; ++i) {
+            OomKill k;
+            k.ts_ms = cur.ts_ms;
+            k.units = hit;
+            if (i < named.size()) {
+                k.named = true;
+                k.victim.pid = named[i];
+                auto seen = find_if(vanished.begin(), vanished.end(), [&](const RecordedRow *r) { return r->pid == named[i]; });
+                if (seen != vanished.end()) k.victim = **seen;
+            } else {
+                while (next < vanished.size() && logged.count(vanished[next]->pid)) ++next;
+                if (next < vanished.size()) k.victim = *vanished[next++];
+            }
+            logged.insert(k.victim.pid);
+            add(move(k));
+        }
+    }
+
+    // Newest first.
+    const deque<OomKill> &log() const { return kills; }
+    unsigned long long total() const { return logged_total; }
+    const string &status() const { return status_line; }
+
+    // Text of the OOM kill screen, one string per line.
+    void format(vector<string> &lines) const {
+        lines.clear();
+        char buf[256];
+        snprintf(buf, sizeof buf, "%llu OOM kill(s) since sysmon started%s", logged_total,
+                 kmsg >= 0 ? "" : "   (no /dev/kmsg access: victims are the largest processes that vanished)");
+        lines.push_back(buf);
+        lines.emplace_back();
+        snprintf(buf, sizeof buf, "%-8s %-7s %-10s %10s %7s %7s  %-20s %-6s %s", "TIME", "PID", "USER", "RSS(kB)", "%MEM",
+                 "%CPU", "UNIT", "HOW", "CMD");
+        lines.push_back(buf);
+        for (const OomKill &k : kills) {
+            char when[16];
+            time_t t = (time_t)(k.ts_ms / 1000);
+            struct tm tm;
+            localtime_r(&t, &tm);
+            strftime(when, sizeof when, "%H:%M:%S", &tm);
+            const RecordedRow &v = k.victim;
+            if (v.pid == 0) {
+                snprintf(buf, sizeof buf, "%-8s %-7s (no vanished process seen; it lived less than a sample)%s%s", when, "?",
+                         k.units.empty() ? "" : "  cgroup: ", k.units.c_str());
+            } else {
+                snprintf(buf, sizeof buf, "%-8s %-7lld %-10.10s %10llu %7.2f %7.2f  %-20.20s %-6s %.60s", when,
+                         (long long)v.pid, v.user.c_str(), (unsigned long long)v.rss_kb, v.mem_percent, v.cpu_percent,
+                         v.unit.empty() ? "-" : v.unit.c_str(), k.named ? "kernel" : "guess", v.cmd.c_str());
+            }
+            lines.push_back(buf);
+        }
+        lines.emplace_back();
+        lines.push_back("(RSS, %MEM and %CPU are from the last sample before the kill; HOW: kernel = named by the");
+        lines.push_back(" kernel log, guess = largest process that vanished, from the cgroup that hit its limit if any)");
+    }
+
+private:
+    struct UnitWatch {
+        string path; // memory.events (v2) or memory.oom_control (v1), "" if neither
+        unsigned long long kills = 0;
+        unsigned long long seen = 0; // seq of the last sample with a process in the unit
+    };
+
+    int kmsg = -1;
+    unsigned long long seq = 0, host_total = 0, logged_total = 0;
+    bool have_host = false;
+    unordered_map<string, UnitWatch> units;
+    deque<OomKill> kills;
+    string status_line;
+
+    static unsigned long long read_unit_kills(const string &path) {
+        pmr::string buf;
+        if (!read_file(path.c_str(), buf)) return 0;
+        return meminfo_value(buf, "oom_kill "); // same line in both files
+    }
+
+    // Learns the cgroup of each new unit and forgets units gone for a while.
+    void watch_units(const RecordedSample &cur) {
+        for (const RecordedRow &r : cur.rows) {
+            auto [it, fresh] = units.try_emplace(r.unit);
+            UnitWatch &w = it->second;
+            w.seen = seq;
+            if (!fresh) continue;
+            string cgroup = read_cgroup_path((pid_t)r.pid);
+            if (cgroup.size() <= 1) continue; // root: only the host counter
+            for (string file : {"/sys/fs/cgroup" + cgroup + "/memory.events",
+                                "/sys/fs/cgroup/memory" + cgroup + "/memory.oom_control"})
+                if (access(file.c_str(), R_OK) == 0) {
+                    w.path = file;
+                    w.kills = read_unit_kills(file);
+                    break;
+                }
+        }
+        erase_if(units, [&](const auto &kv) { return seq - kv.second.seen > OOM_UNIT_IDLE; });
+    }
+
+    // PIDs of the "Killed process <pid> (<comm>)" records logged since the last call.
+    vector<int64_t> read_kernel_log() {
+        vector<int64_t> pids;
+        if (kmsg < 0) return pids;
+        char record[2048];
+        while (true) {
+            ssize_t n = read(kmsg, record, sizeof record - 1);
+            if (n < 0 && errno == EPIPE) continue; // records were overwritten before we read them
+            if (n <= 0) break;
+            string_view text(record, n);
+            size_t at = text.find("Killed process ");
+            if (at == string_view::npos) continue;
+            string_view rest = text.substr(at + 15);
+            pids.push_back((int64_t)next_ull(rest));
+        }
+        return pids;
+    }
+
+    void add(OomKill k) {
+        ++logged_total;
+        char buf[160];
+        if (k.victim.pid)
+            snprintf(buf, sizeof buf, "OOM kills: %llu, last %.24s (%lld, %llu kB)", logged_total, k.victim.cmd.c_str(),
+                     (long long)k.victim.pid, (unsigned long long)k.victim.rss_kb);
+        else
+            snprintf(buf, sizeof buf, "OOM kills: %llu", logged_total);
+        status_line = buf;
+        kills.push_front(move(k));
+        if (kills.size() > OOM_LOG_SIZE) kills.pop_back();
+    }
+};
+
+// OOM kill screen of the TUI: the report of OomTracker::format.
+void draw_oom_frame(Renderer &r, const vector<string> &lines, size_t &scroll) {
+    draw_report_frame(r, "SysMon - OOM kills (newest first)", lines, scroll, "OOM kills: (arrows) scroll  (o) back  (q) quit");
+}
+
+// ---- agents and fleet view ----
+
+// Parses "unix:/path" or "host:port" (IPv6 as "[addr]:port").
+static bool parse_endpoint(const string &spec, sockaddr_storage &addr, socklen_t &len, string &err) {
+    memset(&addr, 0, sizeof addr);
+    if (spec.rfind("unix:", 0) == 0) {
+        sockaddr_un &un = (sockaddr_un &)addr;
+        string path = spec.substr(5);
+        if (path.empty() || path.size() >= sizeof un.sun_path) {
+            err = "bad unix socket path";
+            return false;
+        }
+        un.sun_family = AF_UNIX;
+        memcpy(un.sun_path, path.c_str(), path.size() + 1);
+        len = sizeof un;
+        return true;
+    }
+    size_t colon = spec.rfind(':');
+    if (colon == string::npos) {
+        err = "expected host:port or unix:/path";
+        return false;
+    }
+    string host = spec.substr(0, colon), port = spec.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0 || !res) {
+        err = gai_strerror(rc);
+        return false;
+    }
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static void set_nonblocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+// sysmon agent --listen ADDR [--interval MS] [--top K] [--name NAME]
+int run_agent(int argc, char **argv) {
+    const char *usage = "usage: sysmon agent --listen host:port|unix:/path [--interval MS] [--top K] [--name NAME]\n";
+    string listen_spec, name;
+    int interval_ms = REFRESH_INTERVAL * 1000;
+    size_t top_k = 50;
+    for (int i = 0; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+        if (strcmp(argv[i], "--listen") == 0) listen_spec = argv[i + 1];
+        else if (strcmp(argv[i], "--interval") == 0) interval_ms = max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--top") == 0) top_k = (size_t)max(0, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--name") == 0) name = argv[i + 1];
+        else {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+    }
+    if (listen_spec.empty()) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+    if (name.empty()) {
+        char host[256] = "";
+        gethostname(host, sizeof host - 1);
+        name = host;
+    }
+
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    string err;
+    if (!parse_endpoint(listen_spec, addr, addr_len, err)) {
+        fprintf(stderr, "%s: %s\n", listen_spec.c_str(), err.c_str());
+        return 2;
+    }
+    if (addr.ss_family == AF_UNIX) unlink(((sockaddr_un &)addr).sun_path); // stale socket of an earlier run
+    int lfd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", listen_spec.c_str(), strerror(errno));
+        return 1;
+    }
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (::bind(lfd, (sockaddr *)&addr, addr_len) != 0 || listen(lfd, 16) != 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", listen_spec.c_str(), strerror(errno));
+        close(lfd);
+        return 1;
+    }
+    set_nonblocking(lfd);
+    fprintf(stderr, "agent %s listening on %s\n", name.c_str(), listen_spec.c_str());
+
+    struct Client {
+        int fd;
+        string pending; // bytes not yet accepted by the socket
+        string in;      // received bytes not yet parsed (acks)
+        uint64_t acked = 0;
+        int since_keyframe = 0;
+    };
+    const size_t MAX_PENDING = 4 << 20; // a client this far behind is dropped
+    vector<Client> clients;
+    Collector collector;
+    collector.fields = TABLE_FIELDS & ~PF_BLKIO; // what a snapshot row carries
+    TickArena arena;
+    View view;
+    deque<HostSnapshot> window; // recent snapshots, oldest first
+    uint64_t seq = 0;
+    map<uint64_t, string> frames; // this tick's encodings by base seq (0 = keyframe)
+    ByteWriter frame;
+
+    // queues the newest snapshot for c, coded against its newest acked one
+    auto send_latest = [&](Client &c) {
+        if (window.empty()) return;
+        const HostSnapshot *base = nullptr;
+        if (c.acked && c.since_keyframe < WIRE_KEYFRAME_EVERY)
+            for (const HostSnapshot &s : window)
+                if (s.seq == c.acked && s.seq != window.back().seq) base = &s;
+        auto it = frames.find(base ? base->seq : 0);
+        if (it == frames.end()) {
+            frame.buf.clear();
+            encode_frame(frame, window.back(), base);
+            it = frames.emplace(base ? base->seq : 0, frame.buf).first;
+        }
+        c.pending += it->second;
+        c.since_keyframe = base ? c.since_keyframe + 1 : 1;
+    };
+    using clock = chrono::steady_clock;
+    auto next_sample = clock::now();
+    vector<pollfd> fds;
+    while (true) {
+        auto now = clock::now();
+        if (now >= next_sample) {
+            view.rows.clear();
+            arena.reset();
+            Sample sample(arena.resource());
+            collector.collect(sample, arena.resource());
+            view.rebuild(sample, collector.cgroups);
+            if (window.size() == WIRE_WINDOW) {
+                HostSnapshot recycled = move(window.front()); // keeps its row storage
+                window.pop_front();
+                window.push_back(move(recycled));
+            } else {
+                window.emplace_back();
+            }
+            make_snapshot(window.back(), ++seq, name, unix_ms(), sample, view.rows, top_k);
+            view.rows.clear(); // points into the arena
+            frames.clear();
+            // a client still draining the previous frame skips this one; the
+            // next delta covers both
+            for (Client &c : clients)
+                if (c.pending.empty()) send_latest(c);
+            next_sample = now + chrono::milliseconds(interval_ms);
+        }
+
+        fds.clear();
+        fds.push_back({lfd, POLLIN, 0});
+        for (const Client &c : clients) fds.push_back({c.fd, (short)(POLLIN | (c.pending.empty() ? 0 : POLLOUT)), 0});
+        int wait_ms = (int)max<long long>(chrono::duration_cast<chrono::milliseconds>(next_sample - clock::now()).count(), 0);
+        if (poll(fds.data(), fds.size(), wait_ms) <= 0) continue;
+
+        for (size_t i = 1; i < fds.size(); ++i) {
+            Client &c = clients[i - 1];
+            bool drop = fds[i].revents & (POLLERR | POLLHUP | POLLNVAL);
+            if (fds[i].revents & POLLIN) {
+                char buf[512];
+                ssize_t n = read(c.fd, buf, sizeof buf);
+                if (n == 0 || (n < 0 && errno != EAGAIN)) drop = true;
+                if (n > 0) c.in.append(buf, n);
+                size_t at = 0;
+                while (c.in.size() - at >= 4) {
+                    uint32_t len = ByteReader(string_view(c.in).substr(at, 4)).u32();
+                    if (c.in.size() - at - 4 < len) break;
+                    ByteReader msg(string_view(c.in).substr(at + 4, len));
+                    if (msg.u8() == 'A') {
+                        uint64_t acked = msg.varint();
+                        if (msg.ok) c.acked = acked;
+                    }
+                    at += 4 + len;
+                }
+                c.in.erase(0, at);
+                if (c.in.size() > 4096) drop = true; // not a sysmon client
+            }
+            if (!drop && (fds[i].revents & POLLOUT)) {
+                ssize_t n = send(c.fd, c.pending.data(), c.pending.size(), MSG_NOSIGNAL);
+                if (n > 0) c.pending.erase(0, n);
+                else if (n < 0 && errno != EAGAIN) drop = true;
+            }
+            if (drop || c.pending.size() > MAX_PENDING) {
+                ::close(c.fd);
+                c.fd = -1;
+            }
+        }
+        clients.erase(remove_if(clients.begin(), clients.end(), [](const Client &c) { return c.fd < 0; }), clients.end());
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                clients.push_back({fd, {}, {}, 0, 0});
+                send_latest(clients.back()); // a keyframe of the latest snapshot right away
+            }
+        }
+    }
+}
+
+// Client side of one agent connection; reconnects after failures.
+struct HostConn {
+    string spec;
+    int fd = -1;
+    bool connecting = false;
+    string in; // received bytes not yet decoded
+    string status = "connecting";
+    bool has_snapshot = false;
+    map<uint64_t, HostSnapshot> recent; // decoded snapshots the agent may still code against
+    const HostSnapshot *snapshot = nullptr; // newest
+    vector<const FleetRow *> top;           // its rows, highest %CPU first
+    uint64_t frames = 0, bytes = 0, keyframes = 0;
+    chrono::steady_clock::time_point next_attempt, last_update;
+
+    void disconnect(const string &why) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        connecting = false;
+        in.clear();
+        status = why; // the last snapshot stays on screen
+        next_attempt = chrono::steady_clock::now() + chrono::seconds(REFRESH_INTERVAL);
+    }
+
+    void start_connect() {
+        sockaddr_storage addr;
+        socklen_t len;
+        string err;
+        if (!parse_endpoint(spec, addr, len, err)) {
+            disconnect(err);
+            return;
+        }
+        fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            disconnect(strerror(errno));
+            return;
+        }
+        if (connect(fd, (sockaddr *)&addr, len) == 0) {
+            status = "ok";
+        } else if (errno == EINPROGRESS) {
+            connecting = true;
+        } else {
+            disconnect(strerror(errno));
+        }
+    }
+
+    // Handles poll events; returns true if a new snapshot arrived.
+    bool on_events(short revents) {
+        if (connecting && (revents & (POLLOUT | POLLERR | POLLHUP))) {
+            int so_error = 0;
+            socklen_t l = sizeof so_error;
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &l);
+            if (so_error) {
+                disconnect(strerror(so_error));
+                return false;
+            }
+            connecting = false;
+            status = "ok";
+        }
+        if (!(revents & (POLLIN | POLLHUP | POLLERR))) return false;
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof buf)) > 0) in.append(buf, n);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            disconnect(n == 0 ? "closed" : strerror(errno));
+            return false;
+        }
+        // apply every complete frame, then ack the newest
+        bool fresh = false, bad = false;
+        size_t at = 0;
+        uint64_t ack = UINT64_MAX;
+        while (in.size() - at >= 4) {
+            uint32_t len = ByteReader(string_view(in).substr(at, 4)).u32();
+            if (in.size() - at - 4 < len) break;
+            string_view payload = string_view(in).substr(at + 4, len);
+            at += 4 + len;
+            ++frames;
+            bytes += 4 + len;
+            keyframes += !payload.empty() && payload[0] == 'K';
+            HostSnapshot s;
+            bool base_missing;
+            auto find = [&](uint64_t seq) -> const HostSnapshot * {
+                auto it = recent.find(seq);
+                return it == recent.end() ? nullptr : &it->second;
+            };
+            if (!decode_frame(payload, find, s, base_missing)) {
+                if (!base_missing) {
+                    bad = true;
+                    break;
+                }
+                ack = 0; // ask for a keyframe
+                continue;
+            }
+            // the agent only moves its base forward, so older snapshots are dead;
+            // a keyframe with a lower seq comes from a restarted agent
+            ByteReader header(payload.substr(1));
+            header.varint(); // seq
+            uint64_t base = payload[0] == 'D' ? header.varint() : 0;
+            if (base) recent.erase(recent.begin(), recent.lower_bound(base));
+            else if (!recent.empty() && recent.rbegin()->first >= s.seq) recent.clear();
+            uint64_t seq = s.seq;
+            recent[seq] = move(s);
+            ack = seq;
+            fresh = true;
+        }
+        in.erase(0, at);
+        if (ack != UINT64_MAX && !bad) {
+            ByteWriter w;
+            encode_ack(w, ack);
+            send(fd, w.buf.data(), w.buf.size(), MSG_NOSIGNAL); // a lost ack only costs a bigger delta
+        }
+        if (fresh) {
+            snapshot = &recent.rbegin()->second;
+            top.clear();
+            for (const FleetRow &r : snapshot->rows) top.push_back(&r);
+            sort(top.begin(), top.end(), [](const FleetRow *a, const FleetRow *b) {
+                return a->cpu != b->cpu ? a->cpu > b->cpu : a->mem > b->mem;
+            });
+            has_snapshot = true;
+            last_update = chrono::steady_clock::now();
+        }
+        if (bad) disconnect("bad frame");
+        return fresh;
+    }
+};
+
+// Global top-N over all hosts: a k-way merge of the per-host lists, which
+// agents send already sorted by %CPU.
+void merge_top(const vector<HostConn> &hosts, size_t n, vector<pair<size_t, const FleetRow *>> &out) {
+    out.clear();
+    using Head = tuple<uint32_t, size_t, size_t>; // cpu, host, position
+    priority_queue<Head> heads;
+    for (size_t h = 0; h < hosts.size(); ++h)
+        if (hosts[h].has_snapshot && !hosts[h].top.empty()) heads.push({hosts[h].top[0]->cpu, h, 0});
+    while (!heads.empty() && out.size() < n) {
+        auto [cpu, h, i] = heads.top();
+        heads.pop();
+        const vector<const FleetRow *> &top = hosts[h].top;
+        out.push_back({h, top[i]});
+        if (i + 1 < top.size()) heads.push({top[i + 1]->cpu, h, i + 1});
+    }
+}
+
+void draw_fleet_frame(Renderer &r, const vector<HostConn> &hosts, size_t &scroll) {
+    r.begin_frame();
+    int lines = r.rows();
+    r.putf(0, 0, true, "SysMon fleet - %zu hosts (press q to quit)", hosts.size());
+    r.put(1, 0, "HOST                 AGENT                        STATUS        CPU%   MEM USED/TOTAL (kB)      PROCS   AGE  B/FRAME KEYS");
+    auto now = chrono::steady_clock::now();
+    int row = 2;
+    for (const HostConn &h : hosts) {
+        if (row >= lines - 4) break;
+        if (h.has_snapshot) {
+            const HostSnapshot &s = *h.snapshot;
+            double age = chrono::duration<double>(now - h.last_update).count();
+            r.putf(row++, 0, false, "%-20.20s %-28.28s %-12.12s %6.2f %11llu/%-12llu %6llu %4.0fs %8llu %4llu",
+                   s.host.c_str(), h.spec.c_str(), h.status.c_str(), s.cpu_usage / 100.0, (unsigned long long)s.mem_used,
+                   (unsigned long long)s.mem_total, (unsigned long long)s.nprocs, age,
+                   (unsigned long long)(h.frames ? h.bytes / h.frames : 0), (unsigned long long)h.keyframes);
+        } else {
+            r.putf(row++, 0, false, "%-20s %-28.28s %-.40s", "?", h.spec.c_str(), h.status.c_str());
+        }
+    }
+    ++row;
+    r.put(row++, 0, "HOST                 PID     USER       %CPU   %MEM   RSS(kB)  CMD", true);
+    int max_rows = max(lines - 3 - row, 1);
+    vector<pair<size_t, const FleetRow *>> top;
+    merge_top(hosts, scroll + max_rows, top);
+    scroll = min(scroll, top.size() > (size_t)max_rows ? top.size() - max_rows : 0);
+    for (size_t i = scroll; i < top.size() && row < lines - 3; ++i) {
+        const FleetRow &p = *top[i].second;
+        r.putf(row++, 0, false, "%-20.20s %-7d %-10.10s %6.2f %6.2f %9llu  %.60s", hosts[top[i].first].snapshot->host.c_str(),
+               (int)p.pid, p.user.c_str(), p.cpu_percent(), p.mem_percent(), (unsigned long long)p.rss_kb, p.cmd.c_str());
+    }
+    r.put(lines - 2, 0, "Commands: (arrows) scroll  (q) quit");
+    r.end_frame();
+}
+
+// TUI over several agents: per-host summary rows and the merged top list.
+int run_fleet(const vector<string> &specs, bool ansi, int max_fps) {
+    vector<HostConn> hosts(specs.size());
+    for (size_t i = 0; i < specs.size(); ++i) hosts[i].spec = specs[i];
+    unique_ptr<Renderer> screen;
+    if (ansi) screen.reset(new AnsiRenderer());
+    else screen.reset(new NcursesRenderer());
+    Renderer &r = *screen;
+
+    using clock = chrono::steady_clock;
+    const auto frame_interval = chrono::microseconds(1000000 / max_fps);
+    auto last_draw = clock::now() - frame_interval;
+    size_t scroll = 0;
+    bool dirty = true;
+    vector<pollfd> fds;
+    while (true) {
+        auto now = clock::now();
+        for (HostConn &h : hosts)
+            if (h.fd < 0 && now >= h.next_attempt) {
+                h.start_connect();
+                dirty = true;
+            }
+        if (dirty && now >= last_draw + frame_interval) {
+            draw_fleet_frame(r, hosts, scroll);
+            last_draw = now;
+            dirty = false;
+        }
+
+        // wait on the keyboard and all agent sockets at once; at least once a
+        // second so the AGE column and reconnects move on
+        fds.clear();
+        fds.push_back({STDIN_FILENO, POLLIN, 0});
+        for (const HostConn &h : hosts) fds.push_back({h.fd, (short)(h.connecting ? POLLOUT : POLLIN), 0});
+        auto deadline = dirty ? last_draw + frame_interval : clock::now() + chrono::seconds(1);
+        int wait_ms = (int)max<long long>(chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count(), 0);
+        int ready = poll(fds.data(), fds.size(), wait_ms);
+        if (ready == 0) dirty = true;
+        for (size_t i = 1; ready > 0 && i < fds.size(); ++i) {
+            if (fds[i].fd < 0 || !fds[i].revents) continue;
+            string before = hosts[i - 1].status;
+            if (hosts[i - 1].on_events(fds[i].revents) || hosts[i - 1].status != before) dirty = true;
+        }
+        int page = max(r.rows() - 8 - (int)hosts.size(), 1);
+        for (int ch; (ch = r.get_key(0)) != ERR;) {
+            if (ch == 'q' || ch == 'Q') return 0;
+            if (ch == KEY_UP) scroll = scroll ? scroll - 1 : 0;
+            else if (ch == KEY_DOWN) ++scroll; // clamped when drawn
+            else if (ch == KEY_PPAGE) scroll = scroll > (size_t)page ? scroll - page : 0;
+            else if (ch == KEY_NPAGE) scroll += page;
+            else if (ch == KEY_HOME) scroll = 0;
+            dirty = true;
+        }
+    }
+}
+
+// Appends the first `limit` rows of the view (0 = all) in the given format.
+void write_table(string &out, const Sample &sample, const View &view, OutputFormat format, size_t limit) {
+    size_t n = limit ? min(limit, view.rows.size()) : view.rows.size();
+    switch (format) {
+    case OutputFormat::Text: {
+        char head[256], reclaim[160];
+        format_reclaim(reclaim, sizeof reclaim, sample.reclaim);
+        out.append(head, snprintf(head, sizeof head, "CPU Usage: %.2f%%   Mem: %llu kB total   Used: %llu kB (approx)   %s\n",
+                                  sample.cpu_usage, sample.mem_total, sample.mem_used, reclaim));
+        out += sample.io_delay ? TABLE_HEADER : TABLE_HEADER_NO_IOW;
+        out += '\n';
+        RowFormatter formatter;
+        OomScores oom_scores;
+        for (size_t i = 0; i < n; ++i) {
+            string_view row = formatter.format(*view.rows[i], oom_scores.get(*view.rows[i], 1));
+            if (sample.io_delay) {
+                out.append(row.data(), row.size());
+            } else {
+                auto [head, tail] = RowFormatter::split_io_wait(row);
+                out.append(head.data(), head.size());
+                out.append(tail.data(), tail.size());
+            }
+            out += '\n';
+        }
+        break;
+    }
+    case OutputFormat::Csv:
+        out += sample.io_delay ? "pid,user,cpu_percent,mem_percent,rss_kb,io_wait_percent,unit,cmd\n"
+                               : "pid,user,cpu_percent,mem_percent,rss_kb,unit,cmd\n";
+        for (size_t i = 0; i < n; ++i) {
+            const ProcSnapshot &p = *view.rows[i];
+            append_number(out, p.pid); out += ',';
+            append_csv_field(out, strings.str(p.user)); out += ',';
+            append_fixed2(out, p.cpu_percent); out += ',';
+            append_fixed2(out, p.mem_percent); out += ',';
+            append_number(out, p.rss); out += ',';
+            if (sample.io_delay) { append_fixed2(out, p.io_wait_percent); out += ','; }
+            append_csv_field(out, strings.str(p.unit)); out += ',';
+            append_csv_field(out, strings.str(p.cmd)); out += '\n';
+        }
+        break;
+    case OutputFormat::Json:
+        out += "{\"cpu_usage\":"; append_fixed2(out, sample.cpu_usage);
+        out += ",\"mem_total_kb\":"; append_number(out, sample.mem_total);
+        out += ",\"mem_used_kb\":"; append_number(out, sample.mem_used);
+        out += ",\"processes\":[";
+        for (size_t i = 0; i < n; ++i) {
+            const ProcSnapshot &p = *view.rows[i];
+            if (i) out += ',';
+            out += "{\"pid\":"; append_number(out, p.pid);
+            out += ",\"user\":"; append_json_string(out, strings.str(p.user));
+            out += ",\"cpu_percent\":"; append_fixed2(out, p.cpu_percent);
+            out += ",\"mem_percent\":"; append_fixed2(out, p.mem_percent);
+            out += ",\"rss_kb\":"; append_number(out, p.rss);
+            if (sample.io_delay) { out += ",\"io_wait_percent\":"; append_fixed2(out, p.io_wait_percent); }
+            out += ",\"unit\":"; append_json_string(out, strings.str(p.unit));
+            out += ",\"cmd\":"; append_json_string(out, strings.str(p.cmd));
+            out += '}';
+        }
+        out += "]}\n";
+        break;
+    }
+}
+
+// --once/--batch: two samples interval_ms apart, one table on stdout.
+int run_batch(int interval_ms, OutputFormat format, size_t limit) {
+    Collector collector; // takes the first CPU reading
+    TickArena arena;
+    {
+        // first sample only primes the per-process times: stat files only
+        collector.fields = PF_BLKIO;
+        Sample first(arena.resource());
+        collector.collect(first, arena.resource());
+    }
+    if (interval_ms > 0) usleep(interval_ms * 1000);
+    arena.reset();
+    collector.fields = TABLE_FIELDS;
+    Sample sample(arena.resource());
+    collector.collect(sample, arena.resource());
+    if (sort_key == SortKey::IoWait && !sample.io_delay) {
+        fprintf(stderr, "delay accounting is off (sysctl kernel.task_delayacct), sorting by CPU\n");
+        sort_key = SortKey::Cpu;
+    }
+    View view;
+    view.rebuild(sample, collector.cgroups);
+
+    string out;
+    out.reserve(256 + sample.procs.size() * 128);
+    write_table(out, sample, view, format, limit);
+    return fwrite(out.data(), 1, out.size(), stdout) == out.size() ? 0 : 1;
+}
+
+// ---- benchmarks ----
+
+static double percentile(vector<double> v, double q) {
+    if (v.empty()) return 0.0;
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, (size_t)(q * (v.size() - 1) + 0.5))];
+}
+
+// Startup-to-exit wall time of `sysmon --once --interval 0` (fork + exec + two
+// samples + output to /dev/null).
+static void bench_once(int iterations) {
+    vector<double> ms;
+    for (int i = 0; i < iterations; ++i) {
+        auto t0 = chrono::steady_clock::now();
+        pid_t child = fork();
+        if (child == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            execl("/proc/self/exe", "sysmon", "--once", "--interval", "0", "--format", "csv", (char *)nullptr);
+            _exit(127);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+    }
+    printf("once: %d runs  min %.2f ms  p50 %.2f ms  p99 %.2f ms  max %.2f ms\n", iterations,
+           percentile(ms, 0), percentile(ms, 0.5), percentile(ms, 0.99), percentile(ms, 1));
+}
+
+// Encode/decode throughput of the Gorilla coders on synthetic per-process
+// series shaped like sysmon's: mostly idle processes (constant 0.00 %CPU),
+// slowly drifting %MEM, a few busy processes, 1 s timestamps with jitter.
+static void bench_gorilla(int iterations) {
+    const int series = 2000, points = 500;
+    mt19937_64 rng(42);
+    vector<double> values;
+    vector<int64_t> stamps;
+    values.reserve((size_t)series * points * 2);
+    for (int s = 0; s < series; ++s) {
+        bool busy = s % 20 == 0;
+        double mem = 0.01 + (rng() % 10000) / 1000.0;
+        int64_t t = 1700000000000LL;
+        for (int i = 0; i < points; ++i) {
+            double cpu = busy ? (rng() % 100000) / 1000.0 : 0.0;
+            if (rng() % 50 == 0) mem += ((int)(rng() % 200) - 100) / 10000.0;
+            values.push_back(cpu);
+            values.push_back(mem);
+            t += 1000 + (int64_t)(rng() % 3) - 1;
+            stamps.push_back(t);
+        }
+    }
+    double enc_s = 0, dec_s = 0, ts_enc_s = 0, ts_dec_s = 0;
+    size_t float_bytes = 0, ts_bytes = 0;
+    size_t mismatches = 0;
+    for (int it = 0; it < iterations; ++it) {
+        BitWriter w;
+        auto t0 = chrono::steady_clock::now();
+        for (int s = 0; s < series; ++s) {
+            XorState cpu, mem;
+            for (int i = 0; i < points; ++i) {
+                size_t k = ((size_t)s * points + i) * 2;
+                xor_encode(w, cpu, values[k]);
+                xor_encode(w, mem, values[k + 1]);
+            }
+        }
+        auto t1 = chrono::steady_clock::now();
+        BitReader r(w.buf);
+        for (int s = 0; s < series; ++s) {
+            XorState cpu, mem;
+            for (int i = 0; i < points; ++i) {
+                size_t k = ((size_t)s * points + i) * 2;
+                mismatches += xor_decode(r, cpu) != values[k];
+                mismatches += xor_decode(r, mem) != values[k + 1];
+            }
+        }
+        auto t2 = chrono::steady_clock::now();
+        BitWriter tw;
+        for (int s = 0; s < series; ++s) {
+            DodState st;
+            for (int i = 0; i < points; ++i) dod_encode(tw, st, stamps[(size_t)s * points + i]);
+        }
+        auto t3 = chrono::steady_clock::now();
+        BitReader tr(tw.buf);
+        for (int s = 0; s < series; ++s) {
+            DodState st;
+            for (int i = 0; i < points; ++i) mismatches += dod_decode(tr, st) != stamps[(size_t)s * points + i];
+        }
+        auto t4 = chrono::steady_clock::now();
+        enc_s += chrono::duration<double>(t1 - t0).count();
+        dec_s += chrono::duration<double>(t2 - t1).count();
+        ts_enc_s += chrono::duration<double>(t3 - t2).count();
+        ts_dec_s += chrono::duration<double>(t4 - t3).count();
+        float_bytes = w.buf.size();
+        ts_bytes = tw.buf.size();
+    }
+    double nvalues = (double)values.size() * iterations, nstamps = (double)stamps.size() * iterations;
+    printf("gorilla floats: %zu values  %.2f bits/value  encode %.1f MB/s (%.1f M/s)  decode %.1f MB/s (%.1f M/s)\n",
+           values.size(), float_bytes * 8.0 / values.size(), nvalues * 8 / enc_s / 1e6, nvalues / enc_s / 1e6,
+           nvalues * 8 / dec_s / 1e6, nvalues / dec_s / 1e6);
+    printf("gorilla timestamps: %zu values  %.2f bits/value  encode %.1f M/s  decode %.1f M/s\n",
+           stamps.size(), ts_bytes * 8.0 / stamps.size(), nstamps / ts_enc_s / 1e6, nstamps / ts_dec_s / 1e6);
+    if (mismatches) printf("gorilla: %zu values did not round-trip!\n", mismatches);
+}
+
+// Bytes per tick of the agent stream against the full-table JSON of --once
+// --format json, on a synthetic 10k-process host. Each tick (one iteration)
+// a few hundred busy processes change %CPU, some RSS values move, and ten
+// processes exit and ten start.
+static void bench_wire(int iterations) {
+    const int nprocs = 10000;
+    mt19937_64 rng(7);
+    pmr::vector<ProcSnapshot> procs;
+    static const char *const users[] = {"root", "www-data", "postgres", "app", "nobody"};
+    pid_t next_pid = 1000;
+    auto spawn = [&]() {
+        ProcSnapshot p;
+        p.pid = next_pid++;
+        p.starttime = 100000 + p.pid;
+        p.state = 'S';
+        p.user = strings.intern(users[rng() % size(users)]);
+        char buf[64];
+        snprintf(buf, sizeof buf, "/usr/bin/worker-%d --pool %d", (int)(rng() % 200), (int)(rng() % 8));
+        p.cmd = strings.intern(buf);
+        snprintf(buf, sizeof buf, "app-%d.service", (int)(rng() % 40));
+        p.unit = strings.intern(buf);
+        p.rss = 2000 + rng() % 500000;
+        p.mem_percent = 100.0 * p.rss / 64e6;
+        p.cpu_percent = rng() % 30 == 0 ? (rng() % 5000) / 100.0 : 0.0;
+        return p;
+    };
+    for (int i = 0; i < nprocs; ++i) procs.push_back(spawn());
+
+    CgroupCache cgroups;
+    View view;
+    string json;
+    HostSnapshot prev, cur, decoded, key_decoded;
+    ByteWriter w;
+    size_t json_bytes = 0, delta_bytes = 0, key_bytes = 0, mismatches = 0;
+    double enc_s = 0, dec_s = 0, json_s = 0;
+    for (int it = 0; it <= iterations; ++it) {
+        // evolve the host
+        for (ProcSnapshot &p : procs) {
+            if (p.cpu_percent > 0 || rng() % 100 == 0) p.cpu_percent = rng() % 4 ? (rng() % 5000) / 100.0 : 0.0;
+            if (rng() % 20 == 0) {
+                p.rss += rng() % 64;
+                p.mem_percent = 100.0 * p.rss / 64e6;
+            }
+        }
+        for (int k = 0; k < 10; ++k) {
+            procs.erase(procs.begin() + rng() % procs.size());
+            procs.push_back(spawn());
+        }
+        Sample sample(pmr::get_default_resource());
+        sample.cpu_usage = 37.5;
+        sample.mem_total = 64000000;
+        sample.mem_used = 20000000 + it;
+        sample.procs = procs;
+        view.rebuild(sample, cgroups);
+
+        auto t0 = chrono::steady_clock::now();
+        json.clear();
+        write_table(json, sample, view, OutputFormat::Json, 0);
+        auto t1 = chrono::steady_clock::now();
+        swap(prev, cur);
+        make_snapshot(cur, it + 1, "bench", 1700000000000ULL + it * 2000, sample, view.rows, 0);
+        w.buf.clear();
+        encode_frame(w, cur, it ? &prev : nullptr);
+        auto t2 = chrono::steady_clock::now();
+        bool missing;
+        auto find = [&](uint64_t seq) { return seq == prev.seq ? &prev : nullptr; };
+        if (!decode_frame(string_view(w.buf).substr(4), find, decoded, missing)) ++mismatches;
+        auto t3 = chrono::steady_clock::now();
+        if (decoded.rows.size() != cur.rows.size()) ++mismatches;
+        for (size_t i = 0; i < min(decoded.rows.size(), cur.rows.size()); ++i) {
+            const FleetRow &a = decoded.rows[i], &b = cur.rows[i];
+            mismatches += a.pid != b.pid || a.starttime != b.starttime || a.cpu != b.cpu || a.mem != b.mem ||
+                          a.rss_kb != b.rss_kb || a.user != b.user || a.unit != b.unit || a.cmd != b.cmd;
+        }
+        if (it == 0) {
+            key_bytes = w.buf.size();
+            continue; // the first frame is the keyframe, not a tick
+        }
+        json_bytes += json.size();
+        delta_bytes += w.buf.size();
+        json_s += chrono::duration<double>(t1 - t0).count();
+        enc_s += chrono::duration<double>(t2 - t1).count();
+        dec_s += chrono::duration<double>(t3 - t2).count();
+        view.rows.clear();
+    }
+    printf("wire: %d processes, %d ticks\n", nprocs, iterations);
+    printf("  json (--format json)  %9.0f B/tick  %6.2f ms/tick\n", (double)json_bytes / iterations, json_s * 1e3 / iterations);
+    printf("  keyframe              %9zu B\n", key_bytes);
+    printf("  delta                 %9.0f B/tick  encode %.2f ms  decode %.2f ms  (%.1fx smaller than json)\n",
+           (double)delta_bytes / iterations, enc_s * 1e3 / iterations, dec_s * 1e3 / iterations,
+           (double)json_bytes / max<size_t>(delta_bytes, 1));
+    if (mismatches) printf("wire: %zu rows did not round-trip!\n", mismatches);
+}
+
+// Milliseconds per tick of a live /proc scan: Collector::collect() on one
+// thread against the coroutine pipeline with 1, 2 and 4 workers, then a
+// stream of ticks whose publish stage takes 5 ms (a slow disk), one at a time
+// and with the next tick's reads overlapping the previous publish.
+static void bench_pipeline(int iterations) {
+    TickArena arenas[2];
+    optional<Sample> samples[2];
+    auto per_tick = [&](auto run) {
+        run(0); // warm up buffers and caches
+        auto t0 = chrono::steady_clock::now();
+        for (int it = 1; it <= iterations; ++it) run(it);
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / iterations;
+    };
+    size_t nprocs = 0;
+    {
+        Collector collector;
+        double ms = per_tick([&](int) {
+            samples[0].reset();
+            arenas[0].reset();
+            collector.collect(samples[0].emplace(arenas[0].resource()), arenas[0].resource());
+            nprocs = samples[0]->procs.size();
+        });
+        printf("pipeline: %zu processes, %d ticks\n", nprocs, iterations);
+        printf("  collect (1 thread)      %7.2f ms/tick\n", ms);
+    }
+    for (unsigned threads : {1u, 2u, 4u}) {
+        Pipeline pipeline(threads);
+        double ms = per_tick([&](int) {
+            samples[0].reset();
+            arenas[0].reset();
+            pipeline.run(samples[0].emplace(arenas[0].resource()), arenas[0].resource());
+        });
+        printf("  pipeline (%u workers)    %7.2f ms/tick  (read %.2f ms)\n", threads, ms, pipeline.last_timing().read_ms);
+    }
+    auto slow_disk = [](Sample &, uint64_t) { usleep(5000); };
+    {
+        Pipeline pipeline;
+        pipeline.add_stage(slow_disk);
+        double ms = per_tick([&](int) {
+            samples[0].reset();
+            arenas[0].reset();
+            pipeline.run(samples[0].emplace(arenas[0].resource()), arenas[0].resource());
+        });
+        printf("  + 5 ms publish, serial  %7.2f ms/tick\n", ms);
+    }
+    {
+        Pipeline pipeline;
+        pipeline.add_stage(slow_disk);
+        double ms = per_tick([&](int it) {
+            pipeline.drain(1);
+            samples[it % 2].reset();
+            arenas[it % 2].reset();
+            pipeline.start(samples[it % 2].emplace(arenas[it % 2].resource()), arenas[it % 2].resource());
+        });
+        pipeline.drain();
+        printf("  + 5 ms publish, overlap %7.2f ms/tick\n", ms);
+    }
+}
+
+// This machine's CPUs split into `nodes` contiguous blocks, as if it had that
+// many NUMA nodes; with fewer CPUs than nodes, nodes share CPUs.
+static vector<NumaNode> fake_numa_topology(int nodes) {
+    unsigned cpus = max(thread::hardware_concurrency(), 1u);
+    vector<NumaNode> topology(nodes);
+    for (int k = 0; k < nodes; ++k) {
+        topology[k].id = k;
+        unsigned from = cpus * k / nodes, to = cpus * (k + 1) / nodes;
+        for (unsigned c = from; c < to; ++c) topology[k].cpus.push_back((int)c);
+        if (from == to) topology[k].cpus.push_back((int)(from % cpus));
+    }
+    return topology;
+}
+
+// Flat worker pool against one pinned group per node with the same number of
+// workers, on made-up 2- and 4-node splits of this machine and on its real
+// topology if it has several nodes. A made-up split has no remote memory, so
+// it shows the cost of grouping and pinning; the gain needs real nodes.
+static void bench_numa(int iterations) {
+    TickArena arena;
+    optional<Sample> sample;
+    auto per_tick = [&](Pipeline &pipeline) {
+        auto tick = [&] {
+            sample.reset();
+            arena.reset();
+            pipeline.run(sample.emplace(arena.resource()), arena.resource());
+        };
+        tick(); // warm up buffers and caches
+        auto t0 = chrono::steady_clock::now();
+        for (int it = 0; it < iterations; ++it) tick();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / iterations;
+    };
+    auto compare = [&](const char *label, const vector<NumaNode> &topology) {
+        vector<WorkerGroup> groups = numa_worker_groups(topology);
+        unsigned threads = 0;
+        for (const WorkerGroup &g : groups) threads += g.threads;
+        Pipeline flat(threads), grouped(groups);
+        double flat_ms = per_tick(flat), grouped_ms = per_tick(grouped);
+        printf("  %-22s flat %2u workers %7.2f ms/tick (read %.2f)   %zu groups %7.2f ms/tick (read %.2f)\n", label,
+               threads, flat_ms, flat.last_timing().read_ms, groups.size(), grouped_ms, grouped.last_timing().read_ms);
+    };
+    vector<NumaNode> host = read_numa_nodes();
+    printf("numa: %d ticks, %u CPUs, host has %zu node(s), scanning %zu processes\n", iterations,
+           thread::hardware_concurrency(), host.size(), list_pids(pmr::get_default_resource()).size());
+    compare("made-up 2 nodes", fake_numa_topology(2));
+    compare("made-up 4 nodes", fake_numa_topology(4));
+    if (host.size() >= 2) compare("host topology", host);
+}
+
+// Parse time per process of the generic parse_proc against the field-mask
+// specializations the views use, on a synthetic in-memory /proc of 10,000
+// processes (stat, status and io files shaped like real ones), so file I/O
+// does not drown the difference.
+static void bench_parsers(int iterations) {
+    const int nprocs = 10000;
+    mt19937_64 rng(3);
+    vector<ProcFiles> fixture(nprocs);
+    for (int i = 0; i < nprocs; ++i) {
+        ProcFiles &f = fixture[i];
+        int pid = 1000 + i;
+        char buf[1024];
+        snprintf(buf, sizeof buf, "/usr/bin/worker-%d", (int)(rng() % 300));
+        f.cmd = buf;
+        snprintf(buf, sizeof buf,
+                 "%d (worker %d) S 1 %d %d 0 -1 4194560 %llu 0 12 0 %llu %llu 0 0 20 0 %d 0 %llu %llu %llu "
+                 "18446744073709551615 94558464000000 94558464100000 140727600000000 0 0 0 0 4096 16384 1 0 0 17 %d 0 %llu "
+                 "0 0 0 94558466000000 94558466100000 94558470000000 140727600100000 140727600100100 140727600100100 "
+                 "140727600107000 0\n",
+                 pid, i % 300, pid, pid, (unsigned long long)(rng() % 100000), (unsigned long long)(rng() % 1000000),
+                 (unsigned long long)(rng() % 100000), (int)(1 + rng() % 64), (unsigned long long)(100000 + pid),
+                 (unsigned long long)(rng() % (1ULL << 34)), (unsigned long long)(rng() % 200000), (int)(rng() % 16),
+                 (unsigned long long)(rng() % 50000));
+        f.stat = buf;
+        string status = "Name:\tworker\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t" + to_string(pid) +
+                        "\nNgid:\t0\nPid:\t" + to_string(pid) + "\nPPid:\t1\nTracerPid:\t0\nUid:\t" +
+                        to_string(rng() % 3) + "\t0\t0\t0\nGid:\t0\t0\t0\t0\nFDSize:\t64\n";
+        for (const char *k : {"VmPeak", "VmSize", "VmLck", "VmPin", "VmHWM", "VmRSS", "RssAnon", "RssFile",
+                              "RssShmem", "VmData", "VmStk", "VmExe", "VmLib", "VmPTE", "VmSwap"})
+            status += string(k) + ":\t  " + to_string(rng() % 1000000) + " kB\n";
+        status += "Threads:\t4\nSigQ:\t0/63448\nCpus_allowed_list:\t0-15\nvoluntary_ctxt_switches:\t1234\n";
+        f.status = status;
+        snprintf(buf, sizeof buf, "rchar: %llu\nwchar: %llu\nsyscr: 100\nsyscw: 50\nread_bytes: %llu\n"
+                 "write_bytes: %llu\ncancelled_write_bytes: 0\n",
+                 (unsigned long long)(rng() % 1000000000), (unsigned long long)(rng() % 1000000000),
+                 (unsigned long long)(rng() % 100000000), (unsigned long long)(rng() % 100000000));
+        f.io = buf;
+        f.has_cmd = f.has_stat = f.has_status = f.has_io = true;
+    }
+
+    vector<ProcSnapshot> generic(nprocs), out(nprocs);
+    auto time_ns = [&](auto parse) {
+        auto t0 = chrono::steady_clock::now();
+        for (int it = 0; it < iterations; ++it)
+            for (int i = 0; i < nprocs; ++i) parse(1000 + i, fixture[i], out[i], strings);
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count() / ((double)iterations * nprocs);
+    };
+    for (int i = 0; i < nprocs; ++i) parse_proc(1000 + i, fixture[i], generic[i]); // warm the string pool
+    double generic_ns = time_ns(&parse_proc);
+    printf("parsers: %d processes, %d passes\n", nprocs, iterations);
+    printf("  generic parse_proc        %6.1f ns/process\n", generic_ns);
+    struct { const char *name; unsigned fields; } views[] = {
+        {"all fields (TUI)", PF_ALL},
+        {"table (--once)", TABLE_FIELDS},
+        {"times only (priming)", PF_BLKIO},
+    };
+    size_t mismatches = 0;
+    for (auto &v : views) {
+        double ns = time_ns(proc_parser(v.fields));
+        for (int i = 0; i < nprocs; ++i) {
+            const ProcSnapshot &a = out[i], &b = generic[i];
+            mismatches += a.pid != b.pid || a.utime != b.utime || a.stime != b.stime || a.starttime != b.starttime;
+            if (v.fields & PF_CMD) mismatches += a.cmd != b.cmd;
+            if (v.fields & PF_USER) mismatches += a.user != b.user;
+            if (v.fields & PF_STATE) mismatches += a.state != b.state;
+            if (v.fields & PF_RSS) mismatches += a.rss != b.rss;
+            if (v.fields & PF_IO) mismatches += a.io_read != b.io_read || a.io_write != b.io_write;
+            if (v.fields & PF_BLKIO) mismatches += a.blkio_ticks != b.blkio_ticks;
+        }
+        printf("  %-25s %6.1f ns/process  (%.2fx)\n", v.name, ns, generic_ns / ns);
+        out.assign(nprocs, ProcSnapshot());
+    }
+    if (mismatches) printf("parsers: %zu fields differ from the generic parser!\n", mismatches);
+}
+
+// Throughput of the numeric field scanner over synthetic wide /proc files
+// (a /proc/stat of a 256-CPU host, /proc/interrupts, /proc/diskstats and
+// /proc/<pid>/stat lines), per kernel, against a next_ull() loop. All
+// kernels must decode the same values.
+static void bench_scan(int iterations) {
+    mt19937_64 rng(11);
+    struct Input { const char *name; string text; };
+    vector<Input> inputs;
+    string text = "cpu  " + to_string(rng() % 100000000) + " 0 4518 1349 8873 0 125 0 0 0\n";
+    for (int c = 0; c < 256; ++c) {
+        text += "cpu" + to_string(c);
+        for (int f = 0; f < 10; ++f) text += " " + to_string(f == 3 ? rng() % 1000000000 : rng() % 100000);
+        text += "\n";
+    }
+    text += "intr 182733421 0 9 0 0 0 0 3 0 1 0 0 0 156 0 0 0\nctxt 331567188\nbtime 1792300000\nprocesses 812345\n";
+    inputs.push_back({"/proc/stat (256 cpus)", text});
+    text = "           CPU0       CPU1       CPU2       CPU3       CPU4       CPU5       CPU6       CPU7\n";
+    for (int irq = 0; irq < 200; ++irq) {
+        text += string(irq < 10 ? "  " : irq < 100 ? " " : "") + to_string(irq) + ":";
+        for (int c = 0; c < 8; ++c) text += "  " + to_string(rng() % 100000000);
+        text += "  IR-PCI-MSI 327680-edge      xhci_hcd\n";
+    }
+    inputs.push_back({"/proc/interrupts (8 cpus)", text});
+    text.clear();
+    for (int d = 0; d < 64; ++d) {
+        text += " 259       " + to_string(d) + " nvme0n" + to_string(d);
+        for (int f = 0; f < 17; ++f) text += " " + to_string(rng() % 1000000000);
+        text += "\n";
+    }
+    inputs.push_back({"/proc/diskstats", text});
+    text.clear();
+    for (int i = 0; i < 200; ++i)
+        text += "S 1 1 1 0 -1 4194560 " + to_string(rng() % 100000) + " 0 12 0 " + to_string(rng() % 1000000) +
+                " 3311 0 0 20 0 4 0 " + to_string(rng() % 100000000) + " 1234567168 " + to_string(rng() % 200000) +
+                " 18446744073709551615 94558464000000 94558464100000 140727600000000 0 0 0 0 4096 16384 1 0 0 17 3 0 0 0 0 0\n";
+    inputs.push_back({"/proc/<pid>/stat tails", text});
+
+    uint64_t vals[64];
+    ScanIsa saved = scan_isa();
+    printf("scan: %d passes, active kernel %s\n", iterations, scan_isa_name(saved));
+    size_t mismatches = 0;
+    uint64_t checksum = 0; // printed, so the timed passes cannot be optimized out
+    for (const Input &in : inputs) {
+        string_view all(in.text);
+        auto gbps = [&](auto pass) {
+            uint64_t sum = pass(); // warm up
+            auto t0 = chrono::steady_clock::now();
+            for (int it = 0; it < iterations; ++it) sum += pass();
+            double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            checksum ^= sum;
+            return (double)all.size() * iterations / s / 1e9;
+        };
+        // reference: next_ull() field by field, line by line
+        uint64_t reference = 0;
+        double base = gbps([&] {
+            uint64_t sum = 0;
+            for (string_view rest = all; !rest.empty();) {
+                size_t nl = rest.find('\n');
+                string_view line = rest.substr(0, nl);
+                rest.remove_prefix(nl == string_view::npos ? rest.size() : nl + 1);
+                while (!line.empty()) {
+                    sum += next_ull(line);
+                    while (!line.empty() && (line[0] == ' ' || line[0] == '\t')) line.remove_prefix(1);
+                    if (!line.empty() && (line[0] < '0' || line[0] > '9') && line[0] != '-') // non-numeric field
+                        while (!line.empty() && line[0] != ' ' && line[0] != '\t') line.remove_prefix(1);
+                }
+            }
+            return sum;
+        });
+        printf("  %-26s %6zu B  next_ull %.2f GB/s", in.name, all.size(), base);
+        for (ScanIsa isa : {ScanIsa::Scalar, ScanIsa::Sse42, ScanIsa::Avx2}) {
+            if (!set_scan_isa(isa)) continue;
+            uint64_t check = 0;
+            double g = gbps([&] {
+                uint64_t sum = 0;
+                for (size_t at = 0; at < all.size();) {
+                    size_t used;
+                    size_t n = scan_fields(all.substr(at), vals, 64, &used);
+                    for (size_t k = 0; k < n; ++k) sum += vals[k] * (k + 1);
+                    at += max<size_t>(used, 1);
+                }
+                return sum;
+            });
+            for (size_t at = 0; at < all.size();) {
+                size_t used;
+                size_t n = scan_fields(all.substr(at), vals, 64, &used);
+                for (size_t k = 0; k < n; ++k) check += vals[k] * (k + 1);
+                at += max<size_t>(used, 1);
+            }
+            if (isa == ScanIsa::Scalar) reference = check;
+            mismatches += check != reference;
+            printf("  %s %.2f GB/s", scan_isa_name(isa), g);
+        }
+        printf("\n");
+    }
+    set_scan_isa(saved);
+    printf("scan: checksum %016llx\n", (unsigned long long)checksum);
+    if (mismatches) printf("scan: %zu inputs decoded differently across kernels!\n", mismatches);
+}
+
+struct Benchmark {
+    const char *name;
+    void (*run)(int iterations);
+    int default_iterations;
+};
+
+static const Benchmark benchmarks[] = {
+    {"once", bench_once, 50},
+    {"gorilla", bench_gorilla, 5},
+    {"wire", bench_wire, 30},
+    {"pipeline", bench_pipeline, 50},
+    {"numa", bench_numa, 50},
+    {"parsers", bench_parsers, 20},
+    {"scan", bench_scan, 2000},
+};
+
+int run_bench(int argc, char **argv) {
+    for (const Benchmark &b : benchmarks) {
+        if (argc >= 1 && strcmp(argv[0], b.name) != 0) continue;
+        b.run(argc >= 2 ? max(1, atoi(argv[1])) : b.default_iterations);
+        if (argc >= 1) return 0;
+    }
+    if (argc >= 1) {
+        fprintf(stderr, "unknown benchmark: %s (one of:", argv[0]);
+        for (const Benchmark &b : benchmarks) fprintf(stderr, " %s", b.name);
+        fprintf(stderr, ")\n");
+        return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Hertz = sysconf(_SC_CLK_TCK);
+    total_mem_kb_cache = read_total_memory_kb();
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) return run_bench(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "record") == 0) return run_record(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "export-columnar") == 0) return run_export_columnar(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "dump-columnar") == 0) return run_dump_columnar(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "query") == 0) return run_query(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "diff") == 0) return run_diff(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "rollup") == 0) return run_rollup(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "agent") == 0) return run_agent(argc - 2, argv + 2);
+
+    bool ansi = false, batch = false, numa_workers = false;
+    const char *record_path = nullptr, *rollup_path = nullptr;
+    vector<string> agents;
+    int max_fps = 30;
+    int interval_ms = 500;
+    size_t limit = 0;
+    OutputFormat format = OutputFormat::Text;
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--ansi") == 0) ansi = true;
+        else if (strcmp(a, "--fps") == 0 && has_value) max_fps = max(1, atoi(argv[++i]));
+        else if (strcmp(a, "--numa-workers") == 0) numa_workers = true;
+        else if (strcmp(a, "--once") == 0 || strcmp(a, "--batch") == 0) batch = true;
+        else if (strcmp(a, "--interval") == 0 && has_value) interval_ms = max(0, atoi(argv[++i]));
+        else if (strcmp(a, "-n") == 0 && has_value) limit = (size_t)max(0, atoi(argv[++i]));
+        else if (strcmp(a, "--unit") == 0 && has_value) unit_filter = argv[++i];
+        else if (strcmp(a, "--record") == 0 && has_value) record_path = argv[++i];
+        else if (strcmp(a, "--rollup") == 0 && has_value) rollup_path = argv[++i];
+        else if (strcmp(a, "--connect") == 0 && has_value) agents.push_back(argv[++i]);
+        else if (strcmp(a, "--sort") == 0 && has_value && !strcmp(argv[i + 1], "cpu")) { sort_key = SortKey::Cpu; ++i; }
+        else if (strcmp(a, "--sort") == 0 && has_value && !strcmp(argv[i + 1], "mem")) { sort_key = SortKey::Mem; ++i; }
+        else if (strcmp(a, "--sort") == 0 && has_value && !strcmp(argv[i + 1], "io")) { sort_key = SortKey::IoWait; ++i; }
+        else if (strcmp(a, "--format") == 0 && has_value && !strcmp(argv[i + 1], "text")) { format = OutputFormat::Text; ++i; }
+        else if (strcmp(a, "--format") == 0 && has_value && !strcmp(argv[i + 1], "csv")) { format = OutputFormat::Csv; ++i; }
+        else if (strcmp(a, "--format") == 0 && has_value && !strcmp(argv[i + 1], "json")) { format = OutputFormat::Json; ++i; }
+        else {
+            fprintf(stderr, "usage: %s [--ansi] [--fps N] [--numa-workers] [--record FILE] [--rollup FILE]\n"
+                            "       %s [--ansi] [--fps N] --connect ADDR [--connect ADDR ...]\n"
+                            "       %s agent --listen ADDR [--interval MS] [--top K] [--name NAME]\n"
+                            "       %s --once [--interval MS] [--format text|csv|json] [-n N] [--sort cpu|mem|io] [--unit UNIT]\n"
+                            "       %s bench [name [iterations]]\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 2;
+        }
+    }
+    if (batch) return run_batch(interval_ms, format, limit);
+    if (!agents.empty()) return run_fleet(agents, ansi, max_fps);
+
+    Recorder recorder;
+    if (record_path && !recorder.open(record_path)) {
+        fprintf(stderr, "cannot open %s: %s\n", record_path, strerror(errno));
+        return 1;
+    }
+    RollupStore rollups;
+    string rollup_err;
+    if (rollup_path && !rollups.open(rollup_path, true, rollup_err)) {
+        fprintf(stderr, "%s\n", rollup_err.c_str());
+        return 1;
+    }
+
+    // initialize
+    unique_ptr<Renderer> screen;
+    if (ansi) screen.reset(new AnsiRenderer());
+    else screen.reset(new NcursesRenderer());
+    Renderer &r = *screen;
+
+    TickArena arena;
+    TickStats stats;
+    RowFormatter formatter;
+    optional<Sample> sample; // lives in the arena until the next resample
+    View view;
+
+    // diff screen: base is the marked sample, or base_age samples back in history
+    History history(HISTORY_SAMPLES);
+
+    // Each sample is ranked into the view and handed to the recording stages
+    // on the pipeline's workers while this thread waits in run(). With one
+    // NUMA node (or without --numa-workers) the workers are a flat pool.
+    Pipeline pipeline(numa_workers ? numa_worker_groups(read_numa_nodes()) : vector<WorkerGroup>{});
+    pipeline.set_rank([&](Sample &s, uint64_t) {
+        if (sort_key == SortKey::IoWait && !s.io_delay) sort_key = SortKey::Cpu; // accounting was turned off
+        view.rebuild(s, pipeline.collector.cgroups);
+    });
+    if (recorder.is_open()) pipeline.add_stage([&](Sample &s, uint64_t ts) { recorder.append(s, ts); });
+    if (rollup_path) {
+        pipeline.add_stage([&](Sample &s, uint64_t ts) {
+            double v[ROLLUP_SERIES];
+            rollup_values(s, v);
+            rollups.add(ts, v);
+        });
+    }
+    stats.threads = pipeline.threads();
+    Screen showing = Screen::Table;
+    size_t report_scroll = 0; // of the screens other than the table
+    bool diff_stale = true;
+    optional<RecordedSample> mark;
+    size_t base_age = 0;
+    vector<string> diff_lines;
+    string diff_base;
+    // these two read their files only while their screen is up
+    NumaMonitor numa;
+    vector<string> numa_lines;
+    HugePageMonitor huge_pages;
+    vector<string> huge_page_lines;
+    OomTracker oom;
+    OomScores oom_scores;
+    vector<string> oom_lines;
+    auto refresh_report = [&](uint64_t ts) {
+        if (showing == Screen::Numa) {
+            numa.update(view, ts);
+            numa.format(numa_lines);
+        } else if (showing == Screen::HugePages) {
+            huge_pages.update(ts);
+            huge_pages.format(huge_page_lines);
+        } else if (showing == Screen::OomKills) {
+            oom.format(oom_lines);
+        }
+    };
+    // switches to s, or back to the table if s is up
+    auto toggle_screen = [&](Screen s) {
+        showing = showing == s ? Screen::Table : s;
+        report_scroll = 0;
+    };
+
+    // Sampling runs on the refresh timer (or 'r'); UI-only actions just mark
+    // the screen dirty, and redraws are coalesced to at most max_fps.
+    using clock = chrono::steady_clock;
+    const auto sample_interval = chrono::seconds(REFRESH_INTERVAL);
+    const auto frame_interval = chrono::microseconds(1000000 / max_fps);
+    auto next_sample = clock::now();
+    auto last_draw = clock::now() - frame_interval;
+    bool dirty = false;
+
+    while (true) {
+        auto now = clock::now();
+        if (now >= next_sample) {
+            // collect a new sample; everything transient lives in the arena
+            unsigned long long allocs0 = g_heap_allocs.load(memory_order_relaxed);
+            view.rows.clear();
+            sample.reset();
+            arena.reset();
+            sample.emplace(arena.resource());
+            pipeline.run(*sample, arena.resource());
+            uint64_t ts = unix_ms();
+            stats.read_ms = pipeline.last_timing().read_ms;
+            stats.heap_allocs = g_heap_allocs.load(memory_order_relaxed) - allocs0;
+            stats.collect_ms = chrono::duration<double, milli>(clock::now() - now).count();
+            stats.arena_used = arena.used();
+            stats.arena_capacity = arena.capacity();
+            ++stats.samples;
+            history.push(*sample, ts);
+            oom.update(sample->oom_kills, history.size() > 1 ? &history.at(1) : nullptr, history.at(0));
+            diff_stale = true;
+            refresh_report(ts);
+            next_sample = now + sample_interval;
+            dirty = true;
+        }
+        if (dirty && now >= last_draw + frame_interval) {
+            if (showing == Screen::Diff && diff_stale) {
+                const RecordedSample &latest = history.at(0);
+                const RecordedSample &base = mark ? *mark : history.at(min(base_age, history.size() - 1));
+                format_diff(diff_samples(base, latest), diff_lines, 0);
+                char label[64];
+                snprintf(label, sizeof label, "%s%.0f s ago", mark ? "mark, " : "",
+                         ((double)latest.ts_ms - (double)base.ts_ms) / 1000.0);
+                diff_base = label;
+                diff_stale = false;
+            }
+            if (showing == Screen::Diff) draw_diff_frame(r, diff_lines, report_scroll, diff_base);
+            else if (showing == Screen::Numa) draw_numa_frame(r, numa_lines, report_scroll);
+            else if (showing == Screen::HugePages) draw_huge_page_frame(r, huge_page_lines, report_scroll);
+            else if (showing == Screen::OomKills) draw_oom_frame(r, oom_lines, report_scroll);
+            else draw_frame(r, *sample, view, stats, formatter, oom_scores, oom.status());
+            ++stats.frames;
+            last_draw = now;
+            dirty = false;
+        }
+
+        // wait for a key until the next sample or the next allowed redraw
+        auto deadline = dirty ? min(next_sample, last_draw + frame_interval) : next_sample;
+        int wait_ms = (int)max<long long>(chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count(), 0);
+        int ch = r.get_key(wait_ms);
+        int page = max(r.rows() - 6, 1);
+        if (ch == ERR) continue;
+        if (ch == 'q' || ch == 'Q') break;
+        else if (ch == 's' || ch == 'S') {
+            // CPU -> MEM -> I/O WAIT (while delay accounting is on) -> CPU
+            if (sort_key == SortKey::Cpu) sort_key = SortKey::Mem;
+            else if (sort_key == SortKey::Mem && sample->io_delay) sort_key = SortKey::IoWait;
+            else sort_key = SortKey::Cpu;
+            view.sort_rows();
+            if (showing == Screen::Numa) refresh_report(unix_ms()); // places the new top rows
+            dirty = true;
+        } else if (ch == 'r' || ch == 'R') {
+            next_sample = clock::now();
+        } else if (showing != Screen::Table && (ch == KEY_UP || ch == KEY_DOWN || ch == KEY_PPAGE || ch == KEY_NPAGE || ch == KEY_HOME)) {
+            long delta = ch == KEY_UP ? -1 : ch == KEY_DOWN ? 1 : ch == KEY_PPAGE ? -page : page;
+            report_scroll = ch == KEY_HOME ? 0 : (size_t)max<long>((long)report_scroll + delta, 0); // clamped when drawn
+            dirty = true;
+        }
+        else if (ch == KEY_UP) { view.scroll_by(-1, page); dirty = true; }
+        else if (ch == KEY_DOWN) { view.scroll_by(1, page); dirty = true; }
+        else if (ch == KEY_PPAGE) { view.scroll_by(-page, page); dirty = true; }
+        else if (ch == KEY_NPAGE) { view.scroll_by(page, page); dirty = true; }
+        else if (ch == KEY_HOME) { view.scroll = 0; dirty = true; }
+        else if (ch == 'd' || ch == 'D') {
+            // diff against the mark, or the oldest sample in history
+            toggle_screen(Screen::Diff);
+            if (showing == Screen::Diff && !mark) base_age = history.size() - 1;
+            diff_stale = dirty = true;
+        } else if (ch == 'm' || ch == 'M') {
+            mark = history.at(0);
+            if (showing != Screen::Diff) toggle_screen(Screen::Diff);
+            diff_stale = dirty = true;
+        } else if (ch == 'n' || ch == 'N' || ch == 'h' || ch == 'H' || ch == 'o' || ch == 'O') {
+            // rates appear from the next refresh on
+            int key = tolower(ch);
+            toggle_screen(key == 'n' ? Screen::Numa : key == 'h' ? Screen::HugePages : Screen::OomKills);
+            refresh_report(unix_ms());
+            dirty = true;
+        } else if (showing == Screen::Diff && (ch == '<' || ch == '>')) {
+            base_age = ch == '<' ? min(base_age + 1, history.size() - 1) : (base_age ? base_age - 1 : 0);
+            mark.reset();
+            diff_stale = dirty = true;
+        }
+        else if (ch == KEY_RESIZE) dirty = true;
+        else if (ch == 'k' || ch == 'K') {
+            // ask user for PID (blocking read)
+            char buf[32];
+            r.prompt("Enter PID to kill: ", buf, sizeof buf);
+            int pid = atoi(buf);
+            // over the table, so the row that was picked stays in view
+            char msg[96];
+            if (pid > 0) {
+                int res = kill(pid, SIGTERM);
+                if (res == 0) {
+                    snprintf(msg, sizeof msg, "Sent SIGTERM to %d. Press any key to continue...", pid);
+                } else {
+                    snprintf(msg, sizeof msg, "Failed to kill %d (errno %d). Press any key to continue...", pid, errno);
+                }
+            } else {
+                snprintf(msg, sizeof msg, "Invalid PID. Press any key to continue...");
+            }
+            r.notice(msg);
+            r.get_key(-1);
+            dirty = true;
+        } else if (ch == 'c' || ch == 'C') {
+            // ask user for a container/unit to filter on (empty clears)
+            char buf[128];
+            r.prompt("Show container/unit (empty for all): ", buf, sizeof buf);
+            unit_filter = buf;
+            view.rebuild(*sample, pipeline.collector.cgroups);
+            view.scroll = 0;
+            dirty = true;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+// tests/two_samplers.cpp
+// Two samplers ticking at different rates must not free each other's strings:
+// a fast one sampling only itself, a slow one holding the units of every
+// process. After the fast one has run for many ticks, the slow one's units
+// must still match each process's cgroup.
+
+#include "../sysmon.h"
+#include "../sysmon_core.h"
+
+static int failures = 0;
+
+// Compares the units in s with the cgroup of each process that is still alive.
+static void check_units(const sysmon::Snapshot &s, const char *when) {
+    for (const sysmon::Process &p : s.processes) {
+        string want = cgroup_label(read_cgroup_path(p.pid));
+        if (access(("/proc/" + to_string(p.pid)).c_str(), F_OK) != 0) continue; // exited
+        if (p.unit != want) {
+            fprintf(stderr, "%s: pid %d unit \"%s\", want \"%s\"\n", when, p.pid, p.unit.c_str(), want.c_str());
+            ++failures;
+        }
+    }
+}
+
+int main() {
+    sysmon::Sampler slow(chrono::seconds(60));
+    sysmon::Sampler fast(chrono::milliseconds(10), sysmon::Scope::Self);
+
+    auto first = slow.tick();
+    if (first->processes.empty()) {
+        fprintf(stderr, "no processes sampled\n");
+        return 1;
+    }
+    check_units(*first, "first tick");
+
+    for (int round = 0; round < 5; ++round) {
+        fast.start();
+        this_thread::sleep_for(chrono::milliseconds(100));
+        fast.stop();
+        check_units(*slow.tick(), "after the fast sampler ran");
+    }
+    auto self = fast.latest();
+    if (!self || self->seq < 10 || !sysmon::find_process(*self, getpid())) {
+        fprintf(stderr, "fast sampler did not sample itself\n");
+        ++failures;
+    }
+
+    if (failures) return 1;
+    printf("two_samplers: ok (%zu processes, %llu fast ticks)\n", first->processes.size(),
+           (unsigned long long)self->seq);
+    return 0;
+}